@@ -0,0 +1,219 @@
+// compares LruCache against the std::map + std::list cache it replaced,
+// on access patterns like the ones the viewer's tile cache sees
+//
+// build with "make bench" and run bench/LruCacheBench
+
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <map>
+#include <tuple>
+#include <vector>
+#include <chrono>
+
+#include "LruCache.h"
+
+using namespace std;
+
+
+// the previous implementation, adapted from
+// http://stackoverflow.com/a/25093143/44729
+template< typename K, typename V, class Comp = std::less< K > >
+class MapLruCache
+{
+public:
+    MapLruCache( size_t aCapacity )
+        : mCapacity( aCapacity )
+    { }
+
+    bool insert( const K& aKey, const V& aValue )
+    {
+        if( mCache.find( aKey ) != mCache.end() )
+            return false;
+
+        if( mList.size() == mCapacity )
+        {
+            const typename Cache::iterator it = mCache.find( mList.front() );
+            mCache.erase( it );
+            mList.pop_front();
+        }
+
+        typename List::iterator it = mList.insert( mList.end(), aKey );
+        mCache.insert( std::make_pair( aKey, std::make_pair( aValue, it ) ) );
+        return true;
+    }
+
+    bool get( V& aValue, const K& aKey, const bool updateUsage = true )
+    {
+        typename Cache::iterator it = mCache.find( aKey );
+        if( it == mCache.end() )
+            return false;
+
+        if( updateUsage )
+            mList.splice( mList.end(), mList, (it)->second.second );
+
+        aValue = (it)->second.first;
+        return true;
+    }
+
+    void clear()
+    {
+        mCache.clear();
+        mList.clear();
+    }
+
+private:
+    size_t mCapacity;
+
+    typedef std::list< K > List;
+    List mList;
+
+    typedef std::map< K, std::pair< V, typename List::iterator >, Comp > Cache;
+    Cache mCache;
+};
+
+
+// stand-in for ExtRect without dragging in wx: frame, filter, x, y
+typedef tuple< size_t, int, int, int > Key;
+
+struct KeyHash
+{
+    size_t operator()( const Key& key ) const
+    {
+        size_t h = get<0>( key );
+        h = h * 31 + static_cast< size_t >( get<1>( key ) );
+        h = h * 31 + static_cast< size_t >( get<2>( key ) );
+        h = h * 31 + static_cast< size_t >( get<3>( key ) );
+        h ^= h >> 16;
+        h *= 0x85ebca6b;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35;
+        h ^= h >> 16;
+        return h;
+    }
+};
+
+static const size_t CAPACITY = 1024;
+static const int TILE_SIZE = 256;
+
+// what the viewer does on every repaint: look up every visible tile for
+// each filter tier, and insert whatever's missing
+template< class Cache >
+double Scroll( Cache& cache, const size_t frames, const int gridW, const int gridH, const int viewW, const int viewH )
+{
+    const chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+
+    size_t ops = 0;
+    int value = 0;
+    for( size_t frame = 0; frame < frames; ++frame )
+    {
+        // pan diagonally across the grid, one tile per repaint
+        for( int step = 0; step + viewW <= gridW && step + viewH <= gridH; ++step )
+        {
+            for( int filter = -1; filter < 2; ++filter )
+            {
+                for( int y = step; y < step + viewH; ++y )
+                {
+                    for( int x = step; x < step + viewW; ++x )
+                    {
+                        const Key key( frame, filter, x * TILE_SIZE, y * TILE_SIZE );
+                        if( !cache.get( value, key ) )
+                            cache.insert( key, x + y );
+                        ops++;
+                    }
+                }
+            }
+        }
+    }
+
+    const chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+    return chrono::duration< double, nano >( end - start ).count() / ops;
+}
+
+// lookups of a resident working set
+template< class Cache >
+double Hits( Cache& cache, const size_t lookups )
+{
+    for( int i = 0; i < static_cast< int >( CAPACITY ); ++i )
+    {
+        cache.insert( Key( 0, 1, ( i % 32 ) * TILE_SIZE, ( i / 32 ) * TILE_SIZE ), i );
+    }
+
+    srand( 1 );
+    vector< Key > keys( 4096 );
+    for( size_t i = 0; i < keys.size(); ++i )
+    {
+        const int tile = rand() % CAPACITY;
+        keys[ i ] = Key( 0, 1, ( tile % 32 ) * TILE_SIZE, ( tile / 32 ) * TILE_SIZE );
+    }
+
+    const chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+
+    int value = 0;
+    size_t found = 0;
+    for( size_t i = 0; i < lookups; ++i )
+    {
+        found += cache.get( value, keys[ i % keys.size() ] ) ? 1 : 0;
+    }
+
+    const chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+    if( found != lookups )
+        printf( "unexpected miss!\n" );
+    return chrono::duration< double, nano >( end - start ).count() / lookups;
+}
+
+// inserts of never-seen keys, each one evicting
+template< class Cache >
+double Churn( Cache& cache, const size_t inserts )
+{
+    const chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+
+    for( size_t i = 0; i < inserts; ++i )
+    {
+        const int tile = static_cast< int >( i );
+        cache.insert( Key( i / 1024, 0, ( tile % 32 ) * TILE_SIZE, ( tile / 32 % 32 ) * TILE_SIZE ), tile );
+    }
+
+    const chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+    return chrono::duration< double, nano >( end - start ).count() / inserts;
+}
+
+int main()
+{
+    printf( "%u entry capacity, times in ns per operation\n\n", static_cast< unsigned int >( CAPACITY ) );
+    printf( "workload                    map+list      hashed\n" );
+
+    {
+        MapLruCache< Key, int > before( CAPACITY );
+        LruCache< Key, int, KeyHash > after( CAPACITY );
+        const double beforeNs = Scroll( before, 4, 64, 64, 8, 5 );
+        const double afterNs = Scroll( after, 4, 64, 64, 8, 5 );
+        printf( "scroll (fits)             %9.1f   %9.1f\n", beforeNs, afterNs );
+    }
+
+    {
+        MapLruCache< Key, int > before( CAPACITY );
+        LruCache< Key, int, KeyHash > after( CAPACITY );
+        const double beforeNs = Scroll( before, 4, 128, 128, 20, 12 );
+        const double afterNs = Scroll( after, 4, 128, 128, 20, 12 );
+        printf( "scroll (thrashes)         %9.1f   %9.1f\n", beforeNs, afterNs );
+    }
+
+    {
+        MapLruCache< Key, int > before( CAPACITY );
+        LruCache< Key, int, KeyHash > after( CAPACITY );
+        const double beforeNs = Hits( before, 4000000 );
+        const double afterNs = Hits( after, 4000000 );
+        printf( "hits                      %9.1f   %9.1f\n", beforeNs, afterNs );
+    }
+
+    {
+        MapLruCache< Key, int > before( CAPACITY );
+        LruCache< Key, int, KeyHash > after( CAPACITY );
+        const double beforeNs = Churn( before, 4000000 );
+        const double afterNs = Churn( after, 4000000 );
+        printf( "insert + evict            %9.1f   %9.1f\n", beforeNs, afterNs );
+    }
+
+    return 0;
+}
\ No newline at end of file
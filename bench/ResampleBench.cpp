@@ -0,0 +1,209 @@
+// compares Resample() against the stb_image_resize float sRGB path it
+// replaced, for both speed and error, rendering a whole scaled image
+// in viewer-sized tiles
+//
+// build with "make bench" and run bench/ResampleBench
+
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include <stb/stb_image_resize.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <chrono>
+
+#include "Resampler.h"
+
+using namespace std;
+
+
+static const size_t SRC_SIZE = 1024;
+static const size_t TILE_SIZE = 256;
+
+// smooth gradients with some noise and hard edges on top, so both
+// the flat and the high-contrast cases show up in the error numbers
+vector< unsigned char > MakeImage( size_t w, size_t h )
+{
+    vector< unsigned char > img( w * h * 3 );
+    srand( 1 );
+    for( size_t y = 0; y < h; ++y )
+    {
+        for( size_t x = 0; x < w; ++x )
+        {
+            unsigned char* px = &img[ ( y * w + x ) * 3 ];
+            const bool checker = ( ( x / 16 ) + ( y / 16 ) ) % 2 == 0;
+            px[ 0 ] = static_cast< unsigned char >( x * 255 / w );
+            px[ 1 ] = static_cast< unsigned char >( y * 255 / h );
+            px[ 2 ] = checker ? 255 : 0;
+            if( ( x / 128 ) % 2 == 1 )
+            {
+                for( size_t c = 0; c < 3; ++c )
+                    px[ c ] = static_cast< unsigned char >( rand() );
+            }
+        }
+    }
+    return img;
+}
+
+struct Method
+{
+    enum Type
+    {
+        Stb,
+        LutSrgb,
+        Naive,
+    };
+};
+
+// renders the src scaled by scale into dst one tile at a time,
+// returning the time taken in milliseconds
+double Render
+    (
+    vector< unsigned char >& dst,
+    const size_t dstW,
+    const size_t dstH,
+    const vector< unsigned char >& src,
+    const double scale,
+    const Filter::Type filter,
+    const Method::Type method
+    )
+{
+    const stbir_filter stbFilter = ( Filter::Mitchell == filter ) ? STBIR_FILTER_MITCHELL : STBIR_FILTER_TRIANGLE;
+
+    ScratchArena arena;
+    vector< unsigned char > tile( TILE_SIZE * TILE_SIZE * 3 );
+
+    const chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+
+    // tables are shared by all the tiles of a scale, same as in the viewer
+    const FilterTable horiz( SRC_SIZE, dstW, scale, filter );
+    const FilterTable vert( SRC_SIZE, dstH, scale, filter );
+
+    for( size_t tileY = 0; tileY < dstH; tileY += TILE_SIZE )
+    {
+        for( size_t tileX = 0; tileX < dstW; tileX += TILE_SIZE )
+        {
+            const size_t w = min( TILE_SIZE, dstW - tileX );
+            const size_t h = min( TILE_SIZE, dstH - tileY );
+
+            if( Method::Stb == method )
+            {
+                stbir_resize_subpixel
+                    (
+                    &src[ 0 ], SRC_SIZE, SRC_SIZE, 0,
+                    &tile[ 0 ], w, h, 0,
+                    STBIR_TYPE_UINT8,
+                    3,
+                    STBIR_ALPHA_CHANNEL_NONE,
+                    0,
+                    STBIR_EDGE_CLAMP, STBIR_EDGE_CLAMP,
+                    stbFilter, stbFilter,
+                    STBIR_COLORSPACE_SRGB,
+                    NULL,
+                    static_cast< float >( scale ), static_cast< float >( scale ),
+                    static_cast< float >( tileX ), static_cast< float >( tileY )
+                    );
+            }
+            else
+            {
+                Resample
+                    (
+                    &tile[ 0 ], w, h, tileX, tileY,
+                    &src[ 0 ], SRC_SIZE, 3, Method::LutSrgb == method,
+                    horiz, vert,
+                    arena
+                    );
+                arena.Reset();
+            }
+
+            for( size_t y = 0; y < h; ++y )
+            {
+                copy
+                    (
+                    &tile[ y * w * 3 ],
+                    &tile[ y * w * 3 ] + w * 3,
+                    &dst[ ( ( tileY + y ) * dstW + tileX ) * 3 ]
+                    );
+            }
+        }
+    }
+
+    const chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+    return chrono::duration< double, milli >( end - start ).count();
+}
+
+// best of a few runs to keep scheduler noise out of the numbers
+double BestOf
+    (
+    vector< unsigned char >& dst,
+    const size_t dstW,
+    const size_t dstH,
+    const vector< unsigned char >& src,
+    const double scale,
+    const Filter::Type filter,
+    const Method::Type method
+    )
+{
+    double best = 0.0;
+    for( size_t i = 0; i < 3; ++i )
+    {
+        const double ms = Render( dst, dstW, dstH, src, scale, filter, method );
+        if( 0 == i || ms < best )
+            best = ms;
+    }
+    return best;
+}
+
+void PrintError( const vector< unsigned char >& result, const vector< unsigned char >& reference )
+{
+    int maxErr = 0;
+    double sumErr = 0.0;
+    for( size_t i = 0; i < result.size(); ++i )
+    {
+        const int err = abs( static_cast< int >( result[ i ] ) - static_cast< int >( reference[ i ] ) );
+        maxErr = max( maxErr, err );
+        sumErr += err;
+    }
+    printf( "  max %3d  mean %6.3f", maxErr, sumErr / result.size() );
+}
+
+int main()
+{
+    const vector< unsigned char > src = MakeImage( SRC_SIZE, SRC_SIZE );
+
+    const double scales[] = { 0.25, 0.6, 0.9, 1.5, 3.0 };
+    const Filter::Type filters[] = { Filter::Triangle, Filter::Mitchell };
+    const char* filterNames[] = { "triangle", "mitchell" };
+
+    printf( "%ux%u source, %ux%u tiles, times in ms, errors in 8-bit steps vs. stb\n\n",
+        static_cast< unsigned int >( SRC_SIZE ), static_cast< unsigned int >( SRC_SIZE ),
+        static_cast< unsigned int >( TILE_SIZE ), static_cast< unsigned int >( TILE_SIZE ) );
+    printf( "filter    scale      stb    lut-srgb                            naive\n" );
+
+    for( size_t f = 0; f < sizeof( filters ) / sizeof( filters[ 0 ] ); ++f )
+    {
+        for( size_t s = 0; s < sizeof( scales ) / sizeof( scales[ 0 ] ); ++s )
+        {
+            const double scale = scales[ s ];
+            const size_t dstW = static_cast< size_t >( ceil( SRC_SIZE * scale ) );
+            const size_t dstH = dstW;
+
+            vector< unsigned char > reference( dstW * dstH * 3 );
+            vector< unsigned char > lut( reference.size() );
+            vector< unsigned char > naive( reference.size() );
+
+            const double stbMs = BestOf( reference, dstW, dstH, src, scale, filters[ f ], Method::Stb );
+            const double lutMs = BestOf( lut, dstW, dstH, src, scale, filters[ f ], Method::LutSrgb );
+            const double naiveMs = BestOf( naive, dstW, dstH, src, scale, filters[ f ], Method::Naive );
+
+            printf( "%-8s  %5.2f  %7.1f  %7.1f", filterNames[ f ], scale, stbMs, lutMs );
+            PrintError( lut, reference );
+            printf( "  %7.1f", naiveMs );
+            PrintError( naive, reference );
+            printf( "\n" );
+        }
+    }
+
+    return 0;
+}
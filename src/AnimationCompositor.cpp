@@ -0,0 +1,212 @@
+#include "AnimationCompositor.h"
+
+#include <cstring>
+
+using namespace std;
+
+
+AnimationCompositor::AnimationCompositor( wxAnimationDecoder* decoder )
+    : mDecoder( decoder )
+    , mSize( decoder->GetAnimationSize() )
+    , mBackground( decoder->GetBackgroundColour() )
+    , mCount( decoder->GetFrameCount() )
+    , mWanted( 0 ), mSink( NULL ), mSinkId( wxID_ANY ), mQuit( false )
+    , mChanged( mMutex )
+{
+    if( !mBackground.IsOk() )
+        mBackground = wxColour( 0, 0, 0 );
+
+    mCanvas.resize( static_cast< size_t >( mSize.GetWidth() ) * mSize.GetHeight() * 3 );
+    Fill( wxRect( mSize ), mBackground );
+
+    // the first frame is wanted right now, there's no point in waiting
+    // for a thread to get to it
+    if( mCount > 0 )
+        mFrames.push_back( Composite( 0 ) );
+
+    StartThreads( 1 );
+}
+
+AnimationCompositor::~AnimationCompositor()
+{
+    StopThreads( mMutex, mChanged, mQuit );
+}
+
+bool AnimationCompositor::GetFrame( size_t index, AnimationFrame& frame )
+{
+    wxMutexLocker locker( mMutex );
+    if( index < mFrames.size() )
+    {
+        frame.mImage = mFrames[ index ].mImage;
+        frame.mIndexed = mFrames[ index ].mIndexed;
+        frame.mHashes = mFrames[ index ].mHashes;
+        return true;
+    }
+
+    if( index > mWanted )
+    {
+        mWanted = index;
+        mChanged.Broadcast();
+    }
+    return false;
+}
+
+void AnimationCompositor::SetEventSink( wxEvtHandler* sink, int id )
+{
+    wxMutexLocker locker( mMutex );
+    mSink = sink;
+    mSinkId = id;
+}
+
+size_t AnimationCompositor::GetBytes()
+{
+    // the canvas never changes size
+    size_t bytes = mCanvas.size();
+
+    wxMutexLocker locker( mMutex );
+    for( const AnimationFrame& frame : mFrames )
+    {
+        bytes += frame.GetBytes();
+    }
+    return bytes;
+}
+
+wxThread::ExitCode AnimationCompositor::Entry()
+{
+    mMutex.Lock();
+    while( !mQuit )
+    {
+        const size_t next = mFrames.size();
+        if( next >= mCount || next > mWanted + COMPOSITE_AHEAD )
+        {
+            mChanged.Wait();
+            continue;
+        }
+
+        mMutex.Unlock();
+        const AnimationFrame frame = Composite( next );
+        mMutex.Lock();
+        mFrames.push_back( frame );
+
+        // somebody's waiting on it
+        if( next <= mWanted && NULL != mSink )
+            wxQueueEvent( mSink, new wxThreadEvent( wxEVT_THREAD, mSinkId ) );
+    }
+    mMutex.Unlock();
+
+    return static_cast< wxThread::ExitCode >( 0 );
+}
+
+AnimationFrame AnimationCompositor::Composite( size_t index )
+{
+    const unsigned int i = static_cast< unsigned int >( index );
+    const wxRect frameRect = wxRect( mDecoder->GetFramePosition( i ), mDecoder->GetFrameSize( i ) ).Intersect( wxRect( mSize ) );
+    const wxAnimationDisposal disposal = mDecoder->GetDisposalMethod( i );
+
+    if( wxANIM_TOPREVIOUS == disposal )
+        CopyRect( mSaved, frameRect, false );
+
+    wxImage image;
+    if( mDecoder->ConvertToImage( i, &image ) )
+        Draw( image, mDecoder->GetFramePosition( i ) );
+
+    // index straight out of the canvas, only copying it if that fails
+    AnimationFrame frame;
+    frame.mDelay = static_cast< int >( mDecoder->GetDelay( i ) );
+    const wxImage canvas( mSize, &mCanvas[ 0 ], true );
+    frame.mIndexed = IndexedImage::Create( canvas );
+    if( NULL == frame.mIndexed )
+        frame.mImage = new wxImage( canvas.Copy() );
+
+    // while we're here, rather than on the GUI thread the first time
+    // the panel asks which tiles can be shared
+    frame.mHashes = new BlockHashes( frame, index, mPrevHashes.get() );
+    mPrevHashes = frame.mHashes;
+
+    switch( disposal )
+    {
+        case wxANIM_DONOTREMOVE:
+        case wxANIM_UNSPECIFIED:
+            break;
+        case wxANIM_TOBACKGROUND:
+            Fill( frameRect, mBackground );
+            break;
+        case wxANIM_TOPREVIOUS:
+            CopyRect( mSaved, frameRect, true );
+            break;
+        default:
+            break;
+    }
+
+    return frame;
+}
+
+void AnimationCompositor::Draw( const wxImage& image, const wxPoint& pos )
+{
+    const wxRect rect = wxRect( pos, image.GetSize() ).Intersect( wxRect( mSize ) );
+    if( rect.IsEmpty() )
+        return;
+
+    const size_t canvasW = static_cast< size_t >( mSize.GetWidth() );
+    const size_t srcW = static_cast< size_t >( image.GetWidth() );
+    const unsigned char* srcData = image.GetData();
+    const unsigned char* srcAlpha = image.HasAlpha() ? image.GetAlpha() : NULL;
+    const bool masked = ( NULL == srcAlpha && image.HasMask() );
+    const unsigned char mask[ 3 ] = { image.GetMaskRed(), image.GetMaskGreen(), image.GetMaskBlue() };
+
+    for( int y = rect.GetTop(); y <= rect.GetBottom(); ++y )
+    {
+        for( int x = rect.GetLeft(); x <= rect.GetRight(); ++x )
+        {
+            const size_t src = static_cast< size_t >( y - pos.y ) * srcW + ( x - pos.x );
+            const unsigned char* srcPx = &srcData[ src * 3 ];
+            unsigned char* dstPx = &mCanvas[ ( static_cast< size_t >( y ) * canvasW + x ) * 3 ];
+
+            if( NULL != srcAlpha )
+            {
+                const unsigned int a = srcAlpha[ src ];
+                for( size_t c = 0; c < 3; ++c )
+                {
+                    dstPx[ c ] = static_cast< unsigned char >( ( a * srcPx[ c ] + ( 255 - a ) * dstPx[ c ] + 127 ) / 255 );
+                }
+                continue;
+            }
+
+            if( masked && 0 == memcmp( srcPx, mask, 3 ) )
+                continue;
+
+            memcpy( dstPx, srcPx, 3 );
+        }
+    }
+}
+
+void AnimationCompositor::Fill( const wxRect& rect, const wxColour& color )
+{
+    const size_t canvasW = static_cast< size_t >( mSize.GetWidth() );
+    const unsigned char px[ 3 ] = { color.Red(), color.Green(), color.Blue() };
+    for( int y = rect.GetTop(); y <= rect.GetBottom(); ++y )
+    {
+        for( int x = rect.GetLeft(); x <= rect.GetRight(); ++x )
+        {
+            memcpy( &mCanvas[ ( static_cast< size_t >( y ) * canvasW + x ) * 3 ], px, 3 );
+        }
+    }
+}
+
+void AnimationCompositor::CopyRect( vector< unsigned char >& saved, const wxRect& rect, bool restore )
+{
+    const size_t canvasW = static_cast< size_t >( mSize.GetWidth() );
+    const size_t rowBytes = static_cast< size_t >( rect.GetWidth() ) * 3;
+    if( !restore )
+        saved.resize( rowBytes * rect.GetHeight() );
+
+    for( int y = 0; y < rect.GetHeight(); ++y )
+    {
+        unsigned char* canvasRow = &mCanvas[ ( static_cast< size_t >( rect.GetTop() + y ) * canvasW + rect.GetLeft() ) * 3 ];
+        unsigned char* savedRow = &saved[ y * rowBytes ];
+        if( restore )
+            memcpy( canvasRow, savedRow, rowBytes );
+        else
+            memcpy( savedRow, canvasRow, rowBytes );
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef ANIMATIONCOMPOSITOR_H
+#define ANIMATIONCOMPOSITOR_H
+
+#include <wx/thread.h>
+#include <wx/object.h>
+#include <wx/animdecod.h>
+
+#include <vector>
+
+#include "wxMultiThreadHelper.h"
+#include "AnimationFrame.h"
+
+
+// composites the frames of a GIF or ANI onto a canvas in plain memory,
+// frame 0 right away and the rest on a background thread, staying a
+// few frames ahead of the furthest one asked for
+class AnimationCompositor : public FrameSource, public wxMultiThreadHelper
+{
+public:
+    // takes ownership of decoder, which must already be loaded
+    AnimationCompositor( wxAnimationDecoder* decoder );
+    ~AnimationCompositor();
+
+    virtual bool GetFrame( size_t index, AnimationFrame& frame );
+    virtual void SetEventSink( wxEvtHandler* sink, int id );
+    virtual size_t GetBytes();
+    // compositing a frame needs every one before it, so they all stay
+    virtual bool KeepsFrames() const { return true; }
+
+private:
+    virtual wxThread::ExitCode Entry();
+
+    // only ever called for each frame in order, since each one builds
+    // on what the ones before it left on the canvas
+    AnimationFrame Composite( size_t index );
+
+    // draws image onto the canvas at pos, honoring its mask or alpha
+    void Draw( const wxImage& image, const wxPoint& pos );
+    void Fill( const wxRect& rect, const wxColour& color );
+    // saves rect of the canvas into saved, or puts it back from there
+    void CopyRect( std::vector< unsigned char >& saved, const wxRect& rect, bool restore );
+
+    // how far past the furthest frame asked for to keep going
+    static const size_t COMPOSITE_AHEAD = 8;
+
+    // only touched by whoever is compositing: the constructor for
+    // frame 0, the worker after that
+    wxObjectDataPtr< wxAnimationDecoder > mDecoder;
+    wxSize mSize;
+    wxColour mBackground;
+    std::vector< unsigned char > mCanvas;
+    std::vector< unsigned char > mSaved;
+    BlockHashesPtr mPrevHashes;
+
+    const size_t mCount;
+
+    // composited so far, in order
+    AnimationFrames mFrames;
+    // furthest frame asked for
+    size_t mWanted;
+    wxEvtHandler* mSink;
+    int mSinkId;
+    bool mQuit;
+
+    // guards everything from mFrames on
+    wxMutex mMutex;
+    // signalled when mWanted changes or it's time to quit
+    wxCondition mChanged;
+
+    // no copy ctor/assignment operator
+    AnimationCompositor( const AnimationCompositor& );
+    AnimationCompositor& operator=( const AnimationCompositor& );
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef ANIMATIONFRAME_H
+#define ANIMATIONFRAME_H
+
+#include <wx/sharedptr.h>
+#include <wx/image.h>
+#include <wx/event.h>
+
+#include <vector>
+
+#include "IndexedImage.h"
+#include "BlockHashes.h"
+
+
+struct AnimationFrame;
+
+// makes the pixels of frames that weren't ready when the image was loaded
+class FrameSource
+{
+public:
+    virtual ~FrameSource() { }
+
+    // fills in the pixels of frame index and returns true if they're
+    // ready, otherwise hurries them along and returns false
+    // safe to call from any thread
+    virtual bool GetFrame( size_t index, AnimationFrame& frame ) = 0;
+
+    // sink gets a wxThreadEvent with id whenever a frame that was asked
+    // for becomes ready; no more events get posted once this returns
+    // with a NULL sink
+    virtual void SetEventSink( wxEvtHandler* sink, int id ) = 0;
+
+    // memory held right now: the frames made so far, which the ready
+    // frames handed out share, and whatever they get made from
+    // safe to call from any thread
+    virtual size_t GetBytes() = 0;
+
+    // true if the source holds on to every frame it makes no matter
+    // what, so releasing one frees nothing
+    virtual bool KeepsFrames() const = 0;
+};
+
+// one frame of a (possibly single-frame) image
+// the pixels are in exactly one of mImage or mIndexed, or if neither
+// mSource makes them
+struct AnimationFrame
+{
+    AnimationFrame() : mDelay( -1 ) { }
+
+    wxSharedPtr< wxImage > mImage;
+    IndexedImagePtr mIndexed;
+    wxSharedPtr< FrameSource > mSource;
+
+    // for sharing tiles with earlier frames, if whatever made it hashed it
+    BlockHashesPtr mHashes;
+
+    // in milliseconds
+    int mDelay;
+
+    bool IsReady() const
+    {
+        return NULL != mImage || NULL != mIndexed;
+    }
+
+    // lets go of the pixels (not the hashes), so only worth it if mSource
+    // can make them again and doesn't keep them anyway
+    void Release()
+    {
+        mImage.reset();
+        mIndexed.reset();
+    }
+
+    // empty until it's ready
+    wxSize GetSize() const
+    {
+        if( NULL != mIndexed )
+            return mIndexed->GetSize();
+        return NULL != mImage ? mImage->GetSize() : wxSize();
+    }
+
+    // identifies the pixels, whichever way they're held
+    const void* GetPixels() const
+    {
+        return NULL != mIndexed ? static_cast< const void* >( mIndexed.get() ) : mImage.get();
+    }
+
+    // memory held by the pixels
+    size_t GetBytes() const
+    {
+        if( NULL != mIndexed )
+            return mIndexed->GetBytes();
+        if( NULL == mImage )
+            return 0;
+        const size_t pixels = static_cast< size_t >( mImage->GetWidth() ) * mImage->GetHeight();
+        return pixels * ( mImage->HasAlpha() ? 4 : 3 );
+    }
+};
+typedef std::vector< AnimationFrame > AnimationFrames;
+
+#endif
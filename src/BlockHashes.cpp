@@ -0,0 +1,115 @@
+#include "BlockHashes.h"
+#include "AnimationFrame.h"
+#include "TileKernels.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+
+// FNV-1a, a word at a time
+void HashBytes( unsigned long long& hash, const unsigned char* bytes, const size_t count )
+{
+    const unsigned long long PRIME = 0x100000001b3ULL;
+
+    size_t i = 0;
+    for( ; i + sizeof( unsigned long long ) <= count; i += sizeof( unsigned long long ) )
+    {
+        unsigned long long word;
+        memcpy( &word, &bytes[ i ], sizeof( word ) );
+        hash = ( hash ^ word ) * PRIME;
+    }
+    for( ; i < count; ++i )
+    {
+        hash = ( hash ^ bytes[ i ] ) * PRIME;
+    }
+}
+
+
+BlockHashes::BlockHashes( const AnimationFrame& image, size_t frame, const BlockHashes* prev )
+    : mFrame( frame )
+{
+    const IndexedImagePtr& indexed = image.mIndexed;
+    const size_t w = static_cast< size_t >( image.GetSize().GetWidth() );
+    const size_t h = static_cast< size_t >( image.GetSize().GetHeight() );
+
+    mSize = image.GetSize();
+    mHasAlpha = ( NULL != indexed ) ? indexed->HasAlpha() : image.mImage->HasAlpha();
+    mBlocksX = ( w + BLOCK_SIZE - 1 ) / BLOCK_SIZE;
+    const size_t blocksY = ( h + BLOCK_SIZE - 1 ) / BLOCK_SIZE;
+    mHashes.assign( mBlocksX * blocksY, 0xcbf29ce484222325ULL );
+
+    // indexed frames get expanded a row at a time so the hashes only
+    // depend on the colors, not on how the palette is laid out
+    vector< unsigned char > rgbRow;
+    vector< unsigned char > alphaRow;
+    if( NULL != indexed )
+    {
+        rgbRow.resize( w * 3 );
+        alphaRow.resize( w );
+    }
+
+    const size_t blockSize = BLOCK_SIZE;
+    for( size_t y = 0; y < h; ++y )
+    {
+        const unsigned char* rgb = NULL;
+        const unsigned char* alpha = NULL;
+        if( NULL != indexed )
+        {
+            const unsigned char* indices = &indexed->GetIndices()[ y * w ];
+            PaletteRow( &rgbRow[ 0 ], indices, indexed->GetPalette(), w, 3 );
+            rgb = &rgbRow[ 0 ];
+            if( mHasAlpha )
+            {
+                PaletteRow( &alphaRow[ 0 ], indices, indexed->GetPalette(), w, 1 );
+                alpha = &alphaRow[ 0 ];
+            }
+        }
+        else
+        {
+            rgb = &image.mImage->GetData()[ y * w * 3 ];
+            if( mHasAlpha )
+                alpha = &image.mImage->GetAlpha()[ y * w ];
+        }
+
+        unsigned long long* row = &mHashes[ ( y / BLOCK_SIZE ) * mBlocksX ];
+        for( size_t x = 0; x < w; x += BLOCK_SIZE )
+        {
+            const size_t span = min( blockSize, w - x );
+            HashBytes( row[ x / BLOCK_SIZE ], &rgb[ x * 3 ], span * 3 );
+            if( NULL != alpha )
+                HashBytes( row[ x / BLOCK_SIZE ], &alpha[ x ], span );
+        }
+    }
+
+    // a block starts a new run unless the previous frame has the same
+    // pixels there, and frames of different shapes share nothing
+    mSources.resize( mHashes.size(), frame );
+    if( NULL != prev && prev->mSize == mSize && prev->mHasAlpha == mHasAlpha )
+    {
+        for( size_t i = 0; i < mHashes.size(); ++i )
+        {
+            if( prev->mHashes[ i ] == mHashes[ i ] )
+                mSources[ i ] = prev->mSources[ i ];
+        }
+    }
+}
+
+size_t BlockHashes::GetSourceFrame( const wxRect& rect ) const
+{
+    const wxRect clipped = rect.Intersect( wxRect( wxPoint( 0, 0 ), mSize ) );
+    if( clipped.IsEmpty() )
+        return mFrame;
+
+    // the tile can go back as far as its most recently changed block
+    size_t source = 0;
+    for( size_t y = clipped.GetTop() / BLOCK_SIZE; y <= clipped.GetBottom() / BLOCK_SIZE; ++y )
+    {
+        for( size_t x = clipped.GetLeft() / BLOCK_SIZE; x <= clipped.GetRight() / BLOCK_SIZE; ++x )
+        {
+            source = max( source, mSources[ y * mBlocksX + x ] );
+        }
+    }
+    return source;
+}
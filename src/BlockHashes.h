@@ -0,0 +1,44 @@
+#ifndef BLOCKHASHES_H
+#define BLOCKHASHES_H
+
+#include <wx/sharedptr.h>
+#include <wx/image.h>
+
+#include <vector>
+
+
+struct AnimationFrame;
+
+// one frame of an animation hashed in blocks, so tiles whose source
+// pixels didn't change from the frame before can be shared
+// made by whatever makes the frames, as it makes them, since it takes
+// a pass over every pixel
+class BlockHashes
+{
+public:
+    // image is frame number frame, prev the hashes of the one before it
+    // or NULL if there's no telling what came before
+    BlockHashes( const AnimationFrame& image, size_t frame, const BlockHashes* prev );
+
+    // returns the earliest frame whose pixels in rect are the same as
+    // this one's, going back through unchanged frames without skipping any
+    // rect is in full-size image pixels and gets clipped to the image
+    size_t GetSourceFrame( const wxRect& rect ) const;
+
+private:
+    // blocks are this many pixels on a side
+    static const size_t BLOCK_SIZE = 32;
+
+    size_t mFrame;
+    wxSize mSize;
+    bool mHasAlpha;
+    size_t mBlocksX;
+    std::vector< unsigned long long > mHashes;
+
+    // first frame of the run of frames with this block unchanged
+    std::vector< size_t > mSources;
+};
+
+typedef wxSharedPtr< BlockHashes > BlockHashesPtr;
+
+#endif
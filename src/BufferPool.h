@@ -0,0 +1,84 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <wx/thread.h>
+
+#include <cstdlib>
+#include <vector>
+#include <new>
+
+
+// thread-safe pool of recycled malloc()'d byte buffers
+// buffers are handed out by Acquire() and come back via Release()
+class BufferPool
+{
+public:
+    BufferPool( size_t maxFree )
+        : mMaxFree( maxFree )
+    { }
+
+    ~BufferPool()
+    {
+        for( size_t i = 0; i < mFree.size(); ++i )
+        {
+            free( mFree[ i ].mData );
+        }
+    }
+
+    // returns a buffer of at least size bytes, its actual size goes in capacity
+    unsigned char* Acquire( size_t size, size_t& capacity )
+    {
+        {
+            wxCriticalSectionLocker locker( mCs );
+            for( size_t i = mFree.size(); i > 0; --i )
+            {
+                if( mFree[ i - 1 ].mSize < size )
+                    continue;
+
+                unsigned char* data = mFree[ i - 1 ].mData;
+                capacity = mFree[ i - 1 ].mSize;
+                mFree.erase( mFree.begin() + ( i - 1 ) );
+                return data;
+            }
+        }
+
+        unsigned char* data = static_cast< unsigned char* >( malloc( size ) );
+        if( NULL == data )
+            throw std::bad_alloc();
+        capacity = size;
+        return data;
+    }
+
+    // returns a buffer from Acquire() to the pool, size is its capacity
+    void Release( unsigned char* data, size_t size )
+    {
+        {
+            wxCriticalSectionLocker locker( mCs );
+            if( mFree.size() < mMaxFree )
+            {
+                mFree.push_back( Buffer( data, size ) );
+                return;
+            }
+        }
+
+        free( data );
+    }
+
+private:
+    struct Buffer
+    {
+        Buffer( unsigned char* data, size_t size ) : mData( data ), mSize( size ) {}
+        unsigned char* mData;
+        size_t mSize;
+    };
+
+    wxCriticalSection mCs;
+    std::vector< Buffer > mFree;
+    size_t mMaxFree;
+
+    // no copy ctor/assignment operator
+    BufferPool( const BufferPool& );
+    BufferPool& operator=( const BufferPool& );
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include "FilePrefetcher.h"
+#include "ImageLoader.h"
+
+#include <wx/wfstream.h>
+#include <wx/log.h>
+
+#include <algorithm>
+#include <set>
+
+using namespace std;
+
+
+FilePrefetcher::FilePrefetcher( size_t budget )
+    : mBudget( budget ), mQuit( false ), mChanged( mMutex )
+{
+    // one is plenty, the tile workers want the rest of the CPUs
+    StartThreads( 1 );
+}
+
+FilePrefetcher::~FilePrefetcher()
+{
+    StopThreads( mMutex, mChanged, mQuit );
+}
+
+void FilePrefetcher::SetWanted( const vector< wxString >& paths )
+{
+    wxMutexLocker locker( mMutex );
+    mWanted = paths;
+
+    // things may fit now that didn't before
+    for( Cache::iterator it = mCache.begin(); it != mCache.end(); )
+    {
+        if( it->second.mEvicted )
+            mCache.erase( it++ );
+        else
+            ++it;
+    }
+
+    mChanged.Broadcast();
+}
+
+bool FilePrefetcher::Get( const wxString& path, AnimationFrames& frames )
+{
+    wxMutexLocker locker( mMutex );
+
+    // almost certainly quicker than starting over
+    while( mDecoding == path )
+    {
+        mChanged.Wait();
+    }
+
+    Cache::const_iterator it = mCache.find( path );
+    if( mCache.end() == it || it->second.mFrames.empty() )
+        return false;
+
+    frames = it->second.mFrames;
+    return true;
+}
+
+AnimationFrames FilePrefetcher::Decode( const wxString& path )
+{
+    // don't pop up errors about files nobody has looked at yet,
+    // they'll show up if it comes to loading them for real
+    wxLogNull logNo;
+
+    wxFileStream fs( path );
+    if( !fs.IsOk() )
+        return AnimationFrames();
+
+    return LoadImage( fs );
+}
+
+size_t FilePrefetcher::GetBytes( const AnimationFrames& frames )
+{
+    // frames with a source share its memory, which counts once
+    size_t bytes = 0;
+    set< FrameSource* > sources;
+    for( const AnimationFrame& frame : frames )
+    {
+        if( NULL == frame.mSource )
+            bytes += frame.GetBytes();
+        else if( sources.insert( frame.mSource.get() ).second )
+            bytes += frame.mSource->GetBytes();
+    }
+    return bytes;
+}
+
+void FilePrefetcher::Trim()
+{
+    size_t cachedBytes = 0;
+    for( Cache::iterator it = mCache.begin(); it != mCache.end(); ++it )
+    {
+        it->second.mBytes = GetBytes( it->second.mFrames );
+        cachedBytes += it->second.mBytes;
+    }
+
+    while( cachedBytes > mBudget )
+    {
+        // whatever's furthest down the wanted list, or not on it at all
+        Cache::iterator victim = mCache.end();
+        size_t victimRank = 0;
+        for( Cache::iterator it = mCache.begin(); it != mCache.end(); ++it )
+        {
+            if( 0 == it->second.mBytes )
+                continue;
+
+            const size_t rank = find( mWanted.begin(), mWanted.end(), it->first ) - mWanted.begin();
+            if( mCache.end() == victim || rank > victimRank )
+            {
+                victim = it;
+                victimRank = rank;
+            }
+        }
+
+        if( mCache.end() == victim )
+            break;
+
+        cachedBytes -= victim->second.mBytes;
+        if( victimRank == mWanted.size() )
+        {
+            mCache.erase( victim );
+        }
+        else
+        {
+            // leave an empty entry so the worker doesn't go right back to it
+            victim->second.mFrames.clear();
+            victim->second.mBytes = 0;
+            victim->second.mEvicted = true;
+        }
+    }
+}
+
+wxThread::ExitCode FilePrefetcher::Entry()
+{
+    mMutex.Lock();
+    while( !mQuit )
+    {
+        // first wanted file we haven't gotten to yet
+        wxString path;
+        for( const wxString& wanted : mWanted )
+        {
+            if( mCache.end() == mCache.find( wanted ) )
+            {
+                path = wanted;
+                break;
+            }
+        }
+
+        if( path.empty() )
+        {
+            mChanged.Wait();
+            continue;
+        }
+
+        // decode without holding up Get() for other files
+        mDecoding = path;
+        mMutex.Unlock();
+        const AnimationFrames frames = Decode( path );
+        mMutex.Lock();
+        mDecoding.clear();
+
+        // failures get an entry too so we don't keep retrying them
+        CacheEntry& entry = mCache[ path ];
+        entry.mFrames = frames;
+        entry.mEvicted = false;
+        Trim();
+
+        mChanged.Broadcast();
+    }
+    mMutex.Unlock();
+
+    return static_cast< wxThread::ExitCode >( 0 );
+}
\ No newline at end of file
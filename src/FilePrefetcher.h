@@ -0,0 +1,79 @@
+#ifndef FILEPREFETCHER_H
+#define FILEPREFETCHER_H
+
+#include <wx/thread.h>
+#include <wx/string.h>
+
+#include <map>
+#include <vector>
+
+#include "wxMultiThreadHelper.h"
+#include "AnimationFrame.h"
+
+
+// decodes files on a background thread before they're asked for and
+// keeps the results around, up to a budget of decoded bytes, which
+// counts everything the frame sources of animations and multi-page
+// files hold as well
+class FilePrefetcher : public wxMultiThreadHelper
+{
+public:
+    FilePrefetcher( size_t budget );
+    ~FilePrefetcher();
+
+    // replaces the files worth having decoded, most wanted first
+    // cached files that aren't wanted anymore go first when over budget
+    void SetWanted( const std::vector< wxString >& paths );
+
+    // gets the decoded frames for path if they're cached, waiting for
+    // them if path is being decoded right now
+    // returns false if path hasn't been decoded, in which case it's up
+    // to the caller
+    bool Get( const wxString& path, AnimationFrames& frames );
+
+private:
+    virtual wxThread::ExitCode Entry();
+
+    // decodes path, returning no frames if it can't be
+    static AnimationFrames Decode( const wxString& path );
+    static size_t GetBytes( const AnimationFrames& frames );
+
+    // drops the least wanted entries until we're under budget
+    // frame sources keep going after their file is cached, so what
+    // every entry takes up gets counted again each time
+    // mMutex must be held
+    void Trim();
+
+    struct CacheEntry
+    {
+        // empty if it couldn't be decoded here
+        AnimationFrames mFrames;
+        size_t mBytes;
+
+        // dropped to stay under budget while still wanted, so it's worth
+        // another try once the wanted files change
+        bool mEvicted;
+    };
+    typedef std::map< wxString, CacheEntry > Cache;
+    Cache mCache;
+    const size_t mBudget;
+
+    // most wanted first
+    std::vector< wxString > mWanted;
+
+    // file the worker is busy with, empty if none
+    wxString mDecoding;
+
+    bool mQuit;
+
+    // guards everything above
+    wxMutex mMutex;
+    // signalled when mWanted changes or a decode finishes
+    wxCondition mChanged;
+
+    // no copy ctor/assignment operator
+    FilePrefetcher( const FilePrefetcher& );
+    FilePrefetcher& operator=( const FilePrefetcher& );
+};
+
+#endif
\ No newline at end of file
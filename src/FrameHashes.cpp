@@ -0,0 +1,36 @@
+#include "FrameHashes.h"
+
+using namespace std;
+
+
+FrameHashes::FrameHashes()
+{ }
+
+void FrameHashes::SetFrames( const AnimationFrames& frames )
+{
+    mFrames = frames;
+
+    // only the hashes are needed, and the sources can always make the
+    // pixels again
+    for( AnimationFrame& frame : mFrames )
+    {
+        if( NULL != frame.mSource )
+            frame.Release();
+    }
+}
+
+size_t FrameHashes::GetSourceFrame( size_t frame, const wxRect& rect )
+{
+    // the pages of a multi-image file aren't a sequence
+    if( frame >= mFrames.size() || mFrames[ frame ].mDelay < 0 )
+        return frame;
+
+    AnimationFrame& animFrame = mFrames[ frame ];
+    if( NULL == animFrame.mHashes && NULL != animFrame.mSource && animFrame.mSource->GetFrame( frame, animFrame ) )
+        animFrame.Release();
+
+    if( NULL == animFrame.mHashes )
+        return frame;
+
+    return animFrame.mHashes->GetSourceFrame( rect );
+}
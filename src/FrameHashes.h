@@ -0,0 +1,31 @@
+#ifndef FRAMEHASHES_H
+#define FRAMEHASHES_H
+
+#include <wx/image.h>
+
+#include <vector>
+
+#include "AnimationFrame.h"
+
+
+// finds the earlier frames of an animation that tiles can be shared with
+// the hashes come along with the frames from whatever made them, so
+// nothing here touches pixels
+class FrameHashes
+{
+public:
+    FrameHashes();
+
+    void SetFrames( const AnimationFrames& frames );
+
+    // returns the earliest frame whose pixels in rect are the same as
+    // frame's, going back through unchanged frames without skipping any
+    // rect is in full-size image pixels and gets clipped to the image
+    // frames without hashes yet are their own source
+    size_t GetSourceFrame( size_t frame, const wxRect& rect );
+
+private:
+    AnimationFrames mFrames;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include "ImageLoader.h"
+#include "AnimationCompositor.h"
+#include "PageDecoder.h"
+
+#include <wx/gifdecod.h>
+#include <wx/anidecod.h>
+
+using namespace std;
+
+
+// decoded pages of one multi-image file to keep around
+const size_t PAGE_CACHE_BYTES = 256 * 1024 * 1024;
+
+vector< AnimationFrame > LoadAnimation( wxAnimationDecoder* ad, wxInputStream& stream )
+{
+    vector< AnimationFrame > frames;
+
+    if( !ad->Load( stream ) || 0 == ad->GetFrameCount() )
+    {
+        ad->DecRef();
+        return frames;
+    }
+
+    frames.resize( ad->GetFrameCount() );
+    for( unsigned int i = 0; i < frames.size(); ++i )
+    {
+        frames[ i ].mDelay = static_cast< int >( ad->GetDelay( i ) );
+    }
+
+    wxSharedPtr< FrameSource > compositor( new AnimationCompositor( ad ) );
+    for( size_t i = 0; i < frames.size(); ++i )
+    {
+        frames[ i ].mSource = compositor;
+    }
+    compositor->GetFrame( 0, frames[ 0 ] );
+
+    return frames;
+}
+
+
+vector< AnimationFrame > LoadImage( wxInputStream& stream )
+{
+    if( !stream.IsOk() )
+    {
+        return vector< AnimationFrame >();
+    }
+
+    // special-case animations
+    if( wxGIFDecoder().CanRead( stream ) )
+        return LoadAnimation( new wxGIFDecoder, stream );
+    if( wxANIDecoder().CanRead( stream ) )
+        return LoadAnimation( new wxANIDecoder, stream );
+
+    vector< AnimationFrame > frames( wxImage::GetImageCount( stream ) );
+    if( frames.size() == 1 )
+    {
+        wxSharedPtr< wxImage > image( new wxImage );
+        bool success = false;
+        {
+            // bug workaround
+            // http://trac.wxwidgets.org/ticket/15331
+            wxLogNull logNo;
+            success = image->LoadFile( stream, wxBITMAP_TYPE_ANY, 0 );
+        }
+
+        frames[ 0 ].mImage = image;
+        frames[ 0 ].mDelay = -1;
+        return frames;
+    }
+
+    // multi-image files get their pages decoded as they're looked at
+    wxSharedPtr< FrameSource > pages( new PageDecoder( stream, frames.size(), PAGE_CACHE_BYTES ) );
+    for( size_t i = 0; i < frames.size(); ++i )
+    {
+        frames[ i ].mSource = pages;
+        frames[ i ].mDelay = -1;
+    }
+    if( !frames.empty() )
+        pages->GetFrame( 0, frames[ 0 ] );
+    return frames;
+}
\ No newline at end of file
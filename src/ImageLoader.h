@@ -0,0 +1,20 @@
+#ifndef IMAGELOADER_H
+#define IMAGELOADER_H
+
+#include <wx/stream.h>
+#include <wx/animdecod.h>
+
+#include "AnimationFrame.h"
+
+
+// breaks an animation into a sequence of frames; only the first is
+// ready right away, the rest get composited in the background
+// takes ownership of ad
+AnimationFrames LoadAnimation( wxAnimationDecoder* ad, wxInputStream& stream );
+
+// load a (possibly multi-frame) image from a stream
+// the pages of multi-image files past the first are decoded on demand
+// safe to call from any thread
+AnimationFrames LoadImage( wxInputStream& stream );
+
+#endif
\ No newline at end of file
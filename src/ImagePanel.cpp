@@ -1,12 +1,18 @@
 #include "ImagePanel.h"
 
 #include <wx/dcbuffer.h>
+#include <wx/display.h>
 
 #include <set>
+#include <cmath>
+#include <algorithm>
 
 using namespace std;
 
 
+// scale factor of a single zoom in/out
+const double ZOOM_STEP = 1.1;
+
 vector< wxRect > GetCoverage( const wxRect& viewport, const wxRect& canvas, const wxSize& gridSize )
 {
     const wxRect clippedViewport( canvas.Intersect( viewport ) );
@@ -75,14 +81,20 @@ wxPoint ClampPosition( const wxRect& viewport, const wxRect& extent )
 
 
 
-wxImagePanel::wxImagePanel( wxWindow* parent )
+wxImagePanel::wxImagePanel( wxWindow* parent, const ScaledImageFactory::WorkerOptions& workerOptions )
     : wxWindow( parent, wxID_ANY )
-    , mBitmapCache( 1024 )   // ~200 MB for 1024 256x256x3 byte tiles
+    , mPendingFrame( 0 )
+    , mFrameEventId( wxWindow::NewControlId() )
+    , mBitmapCache( BITMAP_CACHE_BYTES )
     , mPosition( 0, 0 )
     , mScale( 1.0 )
-    , mImageFactory( this )
+    , mImageFactory( this, wxID_ANY, workerOptions )
     , mAnimationTimer( this )
+    , mPlaying( false )
     , mKeyboardTimer( this )
+    , mDeliveryTimer( this )
+    , mRefreshInterval( 0 )
+    , mTopLevel( wxGetTopLevelParent( parent ) )
     , mZoomType( Zoom::Actual )
 {
     // for wxAutoBufferedPaintDC
@@ -102,6 +114,12 @@ wxImagePanel::wxImagePanel( wxWindow* parent )
     Bind( wxEVT_THREAD      , &wxImagePanel::OnThread         , this );
     Bind( wxEVT_TIMER       , &wxImagePanel::OnAnimationTimer , this, mAnimationTimer.GetId() );
     Bind( wxEVT_TIMER       , &wxImagePanel::OnKeyboardTimer  , this, mKeyboardTimer.GetId() );
+    Bind( wxEVT_TIMER       , &wxImagePanel::OnDeliveryTimer  , this, mDeliveryTimer.GetId() );
+    if( NULL != mTopLevel )
+    {
+        mTopLevel->Bind( wxEVT_MOVE             , &wxImagePanel::OnTopLevelMove   , this );
+        mTopLevel->Bind( wxEVT_DISPLAY_CHANGED  , &wxImagePanel::OnDisplayChanged , this );
+    }
 
     AnimationFrames frames( 1 );
     frames[ 0 ].mImage = new wxImage( 1, 1, true );
@@ -109,6 +127,16 @@ wxImagePanel::wxImagePanel( wxWindow* parent )
     SetImages( frames );
 }
 
+wxImagePanel::~wxImagePanel()
+{
+    SetFrameSink( NULL );
+    if( NULL != mTopLevel )
+    {
+        mTopLevel->Unbind( wxEVT_MOVE             , &wxImagePanel::OnTopLevelMove   , this );
+        mTopLevel->Unbind( wxEVT_DISPLAY_CHANGED  , &wxImagePanel::OnDisplayChanged , this );
+    }
+}
+
 
 void wxImagePanel::OnSize( wxSizeEvent& event )
 {
@@ -203,7 +231,7 @@ wxPoint wxImagePanel::ClampPosition( const wxPoint& newPos )
     return ::ClampPosition
         (
         wxRect( newPos, GetSize() ),
-        wxRect( wxPoint(0,0), mImage->GetSize() * mScale )
+        wxRect( wxPoint(0,0), mImageSize * mScale )
         );
 }
 
@@ -226,6 +254,42 @@ void wxImagePanel::OnKeyUp( wxKeyEvent& event )
         case 'H':
             SetZoomType( Zoom::FitHeight );
             break;
+        case 'I':
+            {
+                const ScaledImageFactory::Stats stats = mImageFactory.GetStats();
+                const double total = static_cast< double >( stats.mPixelsRendered + stats.mPixelsCancelled );
+                wxLogStatus
+                    (
+                    "%lu jobs rendered, %lu cancelled (%.1f%% of pixels), %lu skipped",
+                    static_cast< unsigned long >( stats.mJobsRendered ),
+                    static_cast< unsigned long >( stats.mJobsCancelled ),
+                    total > 0.0 ? 100.0 * stats.mPixelsCancelled / total : 0.0,
+                    static_cast< unsigned long >( stats.mJobsSkipped )
+                    );
+            }
+            break;
+        case 'G':
+            // toggle gamma-naive preview tiles and re-render everything
+            mImageFactory.SetNaivePreviews( !mImageFactory.GetNaivePreviews() );
+            mBitmapCache.clear();
+            SetZoomType( Zoom::Previous );
+            break;
+        case ',':
+        case '.':
+            // one worker thread less/more
+            {
+                ScaledImageFactory::WorkerOptions options = mImageFactory.GetWorkerOptions();
+                options.mCount = mImageFactory.GetWorkerCount();
+                if( ',' == event.GetKeyCode() && options.mCount > 1 )
+                    options.mCount--;
+                if( '.' == event.GetKeyCode() )
+                    options.mCount++;
+                mImageFactory.SetWorkerOptions( options );
+                // that dropped everything in flight
+                SetZoomType( Zoom::Previous );
+                wxLogStatus( "%lu worker threads", static_cast< unsigned long >( mImageFactory.GetWorkerCount() ) );
+            }
+            break;
         default:
             break;
     }
@@ -238,22 +302,122 @@ void wxImagePanel::ScrollToPosition( const wxPoint& newPos )
     wxPoint delta( clamped - mPosition );
     ScrollWindow( -delta.x, -delta.y );
     mPosition = clamped;
+
+    UpdatePanVelocity( delta );
+    Prefetch();
+}
+
+
+void wxImagePanel::UpdatePanVelocity( const wxPoint& delta )
+{
+    const long elapsed = mPanWatch.Time();
+    mPanWatch.Start();
+
+    // starting over after a pause
+    if( elapsed > PAN_TIMEOUT )
+        mPanVelocity = wxRealPoint( 0.0, 0.0 );
+
+    // mouse events come in unevenly, so average over the last few
+    const double ms = static_cast< double >( max( elapsed, 1L ) );
+    mPanVelocity.x = mPanVelocity.x * 0.5 + ( delta.x / ms ) * 0.5;
+    mPanVelocity.y = mPanVelocity.y * 0.5 + ( delta.y / ms ) * 0.5;
 }
 
 
-void wxImagePanel::QueueRect( const ExtRect& rect )
+void wxImagePanel::Prefetch()
 {
-    // don't queue rects we have cached
-    wxBitmapPtr bmpPtr;
-    if( mBitmapCache.get( bmpPtr, rect, false ) )
+    // only use workers that would otherwise sit around
+    const size_t workers = mImageFactory.GetWorkerCount();
+    const size_t pending = mImageFactory.GetPendingJobs();
+    if( pending >= workers )
         return;
+    const double idle = static_cast< double >( workers - pending ) / workers;
 
-    // don't queue rects we've already queued
-    if( mQueuedRects.end() != mQueuedRects.find( rect ) )
+    // no more than a screenful ahead
+    const double lookAhead = PREFETCH_TIME * idle;
+    const wxPoint ahead
+        (
+        clamp( static_cast< int >( mPanVelocity.x * lookAhead ), -GetSize().x, GetSize().x ),
+        clamp( static_cast< int >( mPanVelocity.y * lookAhead ), -GetSize().y, GetSize().y )
+        );
+    if( abs( ahead.x ) < MIN_PREFETCH && abs( ahead.y ) < MIN_PREFETCH )
         return;
 
-    mQueuedRects.insert( rect );
-    mImageFactory.AddRect( rect );
+    const wxRect scaledRect( wxPoint( 0, 0 ), mImageSize * mScale );
+    const wxSize gridSize( TILE_SIZE, TILE_SIZE );
+    const vector< wxRect > visibleRects = GetCoverage
+        (
+        wxRect( mPosition, GetSize() ),
+        scaledRect,
+        gridSize
+        );
+    const vector< wxRect > aheadRects = GetCoverage
+        (
+        wxRect( ClampPosition( mPosition + ahead ), GetSize() ),
+        scaledRect,
+        gridSize
+        );
+
+    // the visible tiles get queued by OnPaint() as usual
+    const set< wxRect > visible( visibleRects.begin(), visibleRects.end() );
+    vector< ExtRect > toQueue;
+    for( const wxRect& rect : aheadRects )
+    {
+        if( visible.end() == visible.find( rect ) )
+            toQueue.push_back( GetTile( mCurFrame, GetFilterLadder( mScale ).front(), rect, mScale ) );
+    }
+    QueueRects( toQueue, true );
+}
+
+
+void wxImagePanel::QueueRects( const vector< ExtRect >& rects, bool prefetch )
+{
+    // runs of adjacent tiles in a row go out as one band job so they
+    // share their source reads, capped so there's still enough jobs
+    // to go around the workers
+    vector< ExtRect > band;
+    for( const ExtRect& rect : rects )
+    {
+        // don't queue rects we have cached
+        wxBitmapPtr bmpPtr;
+        if( mBitmapCache.get( bmpPtr, ScaledRect( mScale, rect ), false ) )
+            continue;
+
+        // don't queue rects we've already queued
+        if( mQueuedRects.end() != mQueuedRects.find( rect ) )
+            continue;
+        if( mPrefetchRects.end() != mPrefetchRects.find( rect ) )
+        {
+            if( prefetch )
+                continue;
+
+            // needed now, so it can't wait behind the other prefetches
+            mPrefetchRects.erase( rect );
+        }
+
+        if( !band.empty() )
+        {
+            const ExtRect& last = band.back();
+            if( band.size() == MAX_BAND_TILES ||
+                get<1>( last ) != get<1>( rect ) ||
+                get<2>( last ).GetTop() != get<2>( rect ).GetTop() ||
+                get<2>( last ).GetRight() + 1 != get<2>( rect ).GetLeft() )
+            {
+                mImageFactory.AddBand( band, prefetch );
+                band.clear();
+            }
+        }
+
+        ( prefetch ? mPrefetchRects : mQueuedRects ).insert( rect );
+        band.push_back( rect );
+    }
+
+    mImageFactory.AddBand( band, prefetch );
+
+    // the factory drops speculative jobs (and their results) as soon
+    // as real ones come in; band is only empty if nothing was queued
+    if( !band.empty() )
+        mSpeculativeRects.clear();
 }
 
 
@@ -267,7 +431,7 @@ void wxImagePanel::OnPaint( wxPaintEvent& )
 
     // only clear where we *won't* be drawing image tiles to help prevent flicker
     {
-        const wxRect imageRect( -mPosition, mImage->GetSize() * mScale );
+        const wxRect imageRect( -mPosition, mImageSize * mScale );
         const wxRect viewportRect( wxPoint( 0, 0 ), GetSize() );
         wxRegion region( viewportRect );
         region.Subtract( imageRect );
@@ -278,7 +442,7 @@ void wxImagePanel::OnPaint( wxPaintEvent& )
 
     dc.SetDeviceOrigin( -mPosition.x, -mPosition.y );
 
-    const wxRect scaledRect( wxPoint( 0, 0 ), mImage->GetSize() * mScale );
+    const wxRect scaledRect( wxPoint( 0, 0 ), mImageSize * mScale );
     const wxSize gridSize( TILE_SIZE, TILE_SIZE );
 
     // get the set of tiles we need to draw
@@ -297,30 +461,184 @@ void wxImagePanel::OnPaint( wxPaintEvent& )
         rectsToDraw.insert( ret.begin(), ret.end() );
     }
 
-    for( const wxRect& srcRect : rectsToDraw )
+    // find the best tier we have for every visible tile and how far
+    // up the quality ladder the whole viewport has gotten
+    const vector< int > ladder = GetFilterLadder( mScale );
+    const vector< wxRect > visibleRects = GetCoverage
+        (
+        wxRect( mPosition, GetSize() ),
+        scaledRect,
+        gridSize
+        );
+    bool uncovered = false;
+    size_t coveredTier = ladder.size() - 1;
+    map< wxRect, size_t > bestTiers;
+    for( const wxRect& srcRect : visibleRects )
     {
-        ExtRect niceRect( mCurFrame, 0, srcRect );
-        wxBitmapPtr niceBmpPtr;
-        if( !mAnimationTimer.IsRunning() && !mBitmapCache.get( niceBmpPtr, niceRect ) )
-            QueueRect( niceRect );
+        size_t tier = ladder.size();
+        wxBitmapPtr bmpPtr;
+        for( size_t i = ladder.size(); i > 0; --i )
+        {
+            if( mBitmapCache.get( bmpPtr, ScaledRect( mScale, GetTile( mCurFrame, ladder[ i - 1 ], srcRect, mScale ) ) ) )
+            {
+                tier = i - 1;
+                break;
+            }
+        }
 
-        ExtRect quickRect( mCurFrame, -1, srcRect );
-        wxBitmapPtr quickBmpPtr;
-        if( NULL == niceBmpPtr && !mBitmapCache.get( quickBmpPtr, quickRect ) )
-            QueueRect( quickRect );
+        bestTiers[ srcRect ] = tier;
+        if( tier == ladder.size() )
+            uncovered = true;
+        else
+            coveredTier = min( coveredTier, tier );
+    }
 
+    // only start on the next tier once every visible tile has the current one
+    const size_t nextTier = uncovered ? 0 : coveredTier + 1;
+    if( nextTier < ladder.size() )
+    {
+        vector< ExtRect > toQueue;
+        for( const wxRect& srcRect : visibleRects )
+        {
+            const size_t tier = bestTiers[ srcRect ];
+            if( tier == ladder.size() || tier < nextTier )
+                toQueue.push_back( GetTile( mCurFrame, ladder[ nextTier ], srcRect, mScale ) );
+        }
+        QueueRects( toQueue );
+    }
+    else if( mQueuedRects.empty() )
+    {
+        Speculate();
+    }
+
+    // stand-ins from other scales go down first so anything
+    // drawn for real afterwards covers them up
+    vector< pair< wxRect, wxBitmapPtr > > toDraw;
+    for( const wxRect& srcRect : rectsToDraw )
+    {
         wxBitmapPtr toRender;
-        if( NULL != niceBmpPtr )
-            toRender = niceBmpPtr;
-        else if( NULL != quickBmpPtr )
-            toRender = quickBmpPtr;
-        else
+        for( size_t i = ladder.size(); i > 0 && NULL == toRender; --i )
+        {
+            mBitmapCache.get( toRender, ScaledRect( mScale, GetTile( mCurFrame, ladder[ i - 1 ], srcRect, mScale ) ), false );
+        }
+
+        if( NULL == toRender )
+        {
+            DrawPlaceholder( dc, srcRect );
+            continue;
+        }
+
+        toDraw.push_back( make_pair( srcRect, toRender ) );
+    }
+
+    for( const pair< wxRect, wxBitmapPtr >& tile : toDraw )
+    {
+        dc.DrawBitmap( *tile.second, tile.first.GetPosition() );
+    }
+}
+
+
+void wxImagePanel::DrawPlaceholder( wxDC& dc, const wxRect& rect )
+{
+    // closest scales first
+    vector< double > scales( mRecentScales );
+    const double curScale = mScale;
+    sort( scales.begin(), scales.end(), [&]( const double left, const double right )
+    {
+        return fabs( log( left / curScale ) ) < fabs( log( right / curScale ) );
+    } );
+
+    for( const double scale : scales )
+    {
+        if( scale == mScale )
+            continue;
+
+        // rect in that scale's coordinates
+        const double factor = scale / mScale;
+        const wxRect scaledRect
+            (
+            wxPoint
+                (
+                static_cast< int >( floor( rect.GetLeft() * factor ) ),
+                static_cast< int >( floor( rect.GetTop() * factor ) )
+                ),
+            wxPoint
+                (
+                static_cast< int >( ceil( ( rect.GetRight() + 1 ) * factor ) ) - 1,
+                static_cast< int >( ceil( ( rect.GetBottom() + 1 ) * factor ) ) - 1
+                )
+            );
+        const vector< wxRect > tiles = GetCoverage
+            (
+            scaledRect,
+            wxRect( wxPoint( 0, 0 ), mImageSize * scale ),
+            wxSize( TILE_SIZE, TILE_SIZE )
+            );
+
+        const vector< int > ladder = GetFilterLadder( scale );
+        vector< pair< wxRect, wxBitmapPtr > > found;
+        for( const wxRect& tile : tiles )
+        {
+            wxBitmapPtr bmp;
+            for( size_t i = ladder.size(); i > 0 && NULL == bmp; --i )
+            {
+                mBitmapCache.get( bmp, ScaledRect( scale, GetTile( mCurFrame, ladder[ i - 1 ], tile, scale ) ), false );
+            }
+            if( NULL != bmp )
+                found.push_back( make_pair( tile, bmp ) );
+        }
+
+        if( found.empty() )
             continue;
 
-        dc.DrawBitmap( *toRender, srcRect.GetPosition() );
+        // draw in that scale's coordinates and let the DC stretch them
+        dc.SetUserScale( 1.0 / factor, 1.0 / factor );
+        for( const pair< wxRect, wxBitmapPtr >& tile : found )
+        {
+            dc.DrawBitmap( *tile.second, tile.first.GetPosition() );
+        }
+        dc.SetUserScale( 1.0, 1.0 );
+        return;
     }
+}
 
-    mImageFactory.Sort( std::less< ExtRect >() );
+
+void wxImagePanel::AddRecentScale( const double scale )
+{
+    mRecentScales.erase( remove( mRecentScales.begin(), mRecentScales.end(), scale ), mRecentScales.end() );
+    mRecentScales.insert( mRecentScales.begin(), scale );
+    if( mRecentScales.size() > MAX_RECENT_SCALES )
+        mRecentScales.resize( MAX_RECENT_SCALES );
+}
+
+
+vector< int > wxImagePanel::GetFilterLadder( const double scale ) const
+{
+    vector< int > ladder;
+
+    // quick tiles first so there's always *something* on screen
+    ladder.push_back( Filter::Nearest );
+
+    // nearest is already exact at 1:1
+    if( scale == 1.0 )
+        return ladder;
+
+    // Lanczos is sharper for minification but rings when magnifying
+    const int best = ( scale < 1.0 ? Filter::Lanczos3 : Filter::Mitchell );
+
+    // while an animation plays, every frame's good tiles get rendered
+    // once and then reused each time through the loop, as long as they
+    // all fit; if they don't nobody will notice better filtering go by
+    if( mPlaying )
+    {
+        if( AnimationFits() )
+            ladder.push_back( best );
+        return ladder;
+    }
+
+    ladder.push_back( Filter::Triangle );
+    ladder.push_back( best );
+    return ladder;
 }
 
 
@@ -329,12 +647,23 @@ void wxImagePanel::SetImages( const AnimationFrames& newImages )
     if( newImages.empty() )
         return;
 
+    SetFrameSink( NULL );
     mFrames = newImages;
+    mPendingFrame = mFrames.size();
+    SetFrameSink( this );
+    mFrameHashes.SetFrames( mFrames );
     mImageFactory.Reset();
     mBitmapCache.clear();
+    mRecentScales.clear();
+    mQueuedRects.clear();
+    mPrefetchRects.clear();
+    mSpeculativeRects.clear();
+
+    mPlaying = false;
+    mAnimationTimer.Stop();
 
     mCurFrame = 0;
-    SetImage( mFrames[ mCurFrame ].mImage );
+    SetImage( mFrames[ mCurFrame ] );
     SetZoomType( mZoomType );
     mPosition = ClampPosition( wxPoint( 0, 0 ) );
 
@@ -344,21 +673,43 @@ void wxImagePanel::SetImages( const AnimationFrames& newImages )
     }
 }
 
-void wxImagePanel::SetImage( wxSharedPtr< wxImage > newImage )
+void wxImagePanel::SetImage( const AnimationFrame& frame )
 {
-    mImage = newImage;
-    mQueuedRects.clear();
-    mImageFactory.SetImage( mImage );
+    mImageSize = frame.GetSize();
+    mImageFactory.SetImage( frame );
     mPosition = ClampPosition( mPosition );
     Refresh( false );
 }
 
 void wxImagePanel::SetScale( const double newScale )
 {
-    mBitmapCache.clear();
+    // snap to a scale we've been at if this is it give or take
+    // some rounding, so its tiles match up again
+    double scale = newScale;
+    for( const double recent : mRecentScales )
+    {
+        if( fabs( recent - newScale ) <= newScale * 1e-9 )
+        {
+            scale = recent;
+            break;
+        }
+    }
+    mSpeculativeRects.clear();
+
+    mPosition = GetPositionForScale( scale );
+    mScale = scale;
+    AddRecentScale( mScale );
+
+    mQueuedRects.clear();
+    mPrefetchRects.clear();
+    mImageFactory.SetScale( mScale );
+}
 
-    const wxSize curSize( mImage->GetSize() * mScale );
-    const wxSize newSize( mImage->GetSize() * newScale );
+
+wxPoint wxImagePanel::GetPositionForScale( const double newScale ) const
+{
+    const wxSize curSize( mImageSize * mScale );
+    const wxSize newSize( mImageSize * newScale );
     const wxSize center( GetSize() * 0.5 );
 
     // convert current position into image-parametric 
@@ -379,30 +730,162 @@ void wxImagePanel::SetScale( const double newScale )
     // location of the top-left corner of the viewport
     const wxRealPoint newPoint = newCoords - center;
 
-    mScale = newScale;
-    mPosition = ClampPosition( newPoint );
+    return ::ClampPosition
+        (
+        wxRect( newPoint, GetSize() ),
+        wxRect( wxPoint( 0, 0 ), newSize )
+        );
+}
 
-    mQueuedRects.clear();
-    mImageFactory.SetScale( mScale );
+
+void wxImagePanel::Speculate()
+{
+    // animations move on before any of it would get used
+    if( mPlaying )
+        return;
+
+    const double scales[] = { mScale * ZOOM_STEP, mScale / ZOOM_STEP };
+    for( const double scale : scales )
+    {
+        // only the best tier, that's what a zoom would otherwise wait on
+        const int filter = GetFilterLadder( scale ).back();
+        const vector< wxRect > rects = GetCoverage
+            (
+            wxRect( GetPositionForScale( scale ), GetSize() ),
+            wxRect( wxPoint( 0, 0 ), mImageSize * scale ),
+            wxSize( TILE_SIZE, TILE_SIZE )
+            );
+
+        for( const wxRect& rect : rects )
+        {
+            const ScaledRect scaledRect( scale, GetTile( mCurFrame, filter, rect, scale ) );
+            wxBitmapPtr bmpPtr;
+            if( mBitmapCache.get( bmpPtr, scaledRect, false ) )
+                continue;
+            if( !mSpeculativeRects.insert( scaledRect ).second )
+                continue;
+            mImageFactory.AddSpeculativeRect( scaledRect.second, scale );
+        }
+    }
+}
+
+
+int wxImagePanel::GetRefreshInterval()
+{
+    if( 0 != mRefreshInterval )
+        return mRefreshInterval;
+
+    int refresh = 0;
+    const int display = wxDisplay::GetFromWindow( this );
+    if( wxNOT_FOUND != display )
+        refresh = wxDisplay( display ).GetCurrentMode().refresh;
+
+    // not all platforms know, assume the usual
+    if( refresh <= 0 )
+        refresh = 60;
+    mRefreshInterval = 1000 / refresh;
+    return mRefreshInterval;
 }
 
 
-void wxImagePanel::OnThread( wxThreadEvent& )
+// we may have ended up on another display
+void wxImagePanel::OnTopLevelMove( wxMoveEvent& event )
 {
+    mRefreshInterval = 0;
+    event.Skip();
+}
+
+void wxImagePanel::OnDisplayChanged( wxDisplayChangedEvent& event )
+{
+    mRefreshInterval = 0;
+    event.Skip();
+}
+
+
+void wxImagePanel::OnThread( wxThreadEvent& event )
+{
+    if( event.GetId() == mFrameEventId )
+    {
+        if( mPendingFrame < mFrames.size() && ShowFrame( mPendingFrame ) && mPlaying )
+            Play( false );
+        return;
+    }
+
+    // draw at most once per display refresh; results finishing in the
+    // meantime pile up in the factory and go out in the next batch
+    const long wait = GetRefreshInterval() - mDeliveryWatch.Time();
+    if( wait > 0 )
+    {
+        if( !mDeliveryTimer.IsRunning() )
+            mDeliveryTimer.Start( static_cast< int >( wait ), wxTIMER_ONE_SHOT );
+        return;
+    }
+
+    DeliverResults();
+}
+
+
+void wxImagePanel::OnDeliveryTimer( wxTimerEvent& WXUNUSED( event ) )
+{
+    DeliverResults();
+}
+
+
+void wxImagePanel::DeliverResults()
+{
+    mDeliveryWatch.Start();
+    mImageFactory.AcknowledgeResults();
+
     wxClientDC dc( this );
     dc.SetDeviceOrigin( -mPosition.x, -mPosition.y );
 
     ExtRect rect;
     wxSharedPtr< wxImage > image;
-    while( mImageFactory.GetImage( rect, image ) )
+    double scale = 0.0;
+    bool delivered = false;
+    while( mImageFactory.GetImage( rect, image, scale ) )
     {
-        mQueuedRects.erase( rect );
+        if( scale != mScale )
+        {
+            // speculative, keep it for when we zoom there
+            mSpeculativeRects.erase( ScaledRect( scale, rect ) );
+            if( NULL == image )
+                continue;
+
+            mBitmapCache.insert( ScaledRect( scale, rect ), wxBitmapPtr( new wxBitmap( *image ) ) );
+
+            // it has tiles now, so snapping and placeholders should know
+            // about it, but behind the scale we're actually at
+            if( find( mRecentScales.begin(), mRecentScales.end(), scale ) == mRecentScales.end() )
+            {
+                AddRecentScale( scale );
+                AddRecentScale( mScale );
+            }
+            continue;
+        }
+
+        // only the viewport's tiles hold up the next tier
+        if( mQueuedRects.erase( rect ) > 0 )
+            delivered = true;
+        else
+            mPrefetchRects.erase( rect );
+
+        // skipped because it scrolled out of view
+        if( NULL == image )
+            continue;
 
         wxBitmapPtr bmp( new wxBitmap( *image ) );
-        mBitmapCache.insert( rect, bmp );
+        mBitmapCache.insert( ScaledRect( mScale, rect ), bmp );
 
-        dc.DrawBitmap( *bmp, get<2>( rect ).GetPosition() );
+        // frames rendered ahead wait in the cache for their turn
+        if( rect == GetTile( mCurFrame, get<1>( rect ), get<2>( rect ), mScale ) )
+            dc.DrawBitmap( *bmp, get<2>( rect ).GetPosition() );
     }
+
+    // everything we asked for is in, repaint so the next
+    // quality tier (if any) gets queued up
+    if( delivered && mQueuedRects.empty() )
+        Refresh( false );
 }
 
 void wxImagePanel::Play( bool toggle )
@@ -412,8 +895,9 @@ void wxImagePanel::Play( bool toggle )
         return;
     }
 
-    if( toggle && mAnimationTimer.IsRunning() )
+    if( toggle && mPlaying )
     {
+        mPlaying = false;
         mAnimationTimer.Stop();
 
         // we're stopping the animation so redraw entire window 
@@ -424,40 +908,193 @@ void wxImagePanel::Play( bool toggle )
     {
         if( mFrames[ mCurFrame ].mDelay >= 0 )
         {
+            mPlaying = true;
             mAnimationTimer.Stop();
             mAnimationTimer.StartOnce( mFrames[ mCurFrame ].mDelay );
         }
     }
 }
 
-void wxImagePanel::IncrementFrame( bool forward )
+bool wxImagePanel::IncrementFrame( bool forward )
 {
     if( mFrames.size() <= 1 )
     {
-        return;
+        return false;
     }
 
+    // step from wherever we're headed, not from what's on screen
+    size_t frame = ( mPendingFrame < mFrames.size() ? mPendingFrame : mCurFrame );
     if( forward )
     {
-        mCurFrame++;
-        if( mCurFrame >= mFrames.size() )
-            mCurFrame = 0;
+        frame++;
+        if( frame >= mFrames.size() )
+            frame = 0;
     }
     else
     {
-        if( mCurFrame == 0 )
-            mCurFrame = mFrames.size() - 1;
+        if( frame == 0 )
+            frame = mFrames.size() - 1;
         else
-            mCurFrame--;
+            frame--;
+    }
+
+    return ShowFrame( frame );
+}
+
+bool wxImagePanel::ResolveFrame( size_t frame )
+{
+    AnimationFrame& animFrame = mFrames[ frame ];
+    if( animFrame.IsReady() )
+        return true;
+    if( NULL == animFrame.mSource )
+        return false;
+    return animFrame.mSource->GetFrame( frame, animFrame );
+}
+
+bool wxImagePanel::ShowFrame( size_t frame )
+{
+    if( !ResolveFrame( frame ) )
+    {
+        mPendingFrame = frame;
+        return false;
+    }
+
+    // don't pin the pixels of frames we're done with if their sources
+    // can make them again when they come back around (queued jobs hold
+    // on to the ones they still render from); sources that keep every
+    // frame anyway would free nothing, and we'd only lose the mip chains;
+    // while playing, the frames coming up next stay, they're about to
+    // be queued ahead
+    const size_t keep = ( mPlaying ? ANIMATION_LOOKAHEAD : 0 );
+    for( size_t i = 0; i < mFrames.size(); ++i )
+    {
+        const size_t ahead = ( i + mFrames.size() - frame ) % mFrames.size();
+        if( ahead <= keep || NULL == mFrames[ i ].mSource || mFrames[ i ].mSource->KeepsFrames() )
+            continue;
+
+        mImageFactory.ForgetFrame( mFrames[ i ] );
+        mFrames[ i ].Release();
+    }
+
+    mPendingFrame = mFrames.size();
+    mCurFrame = frame;
+    DropStaleFrames();
+    SetImage( mFrames[ mCurFrame ] );
+    QueueFramesAhead();
+    return true;
+}
+
+void wxImagePanel::DropStaleFrames()
+{
+    // a queued tile is still wanted if one of those frames would
+    // get it from GetTile()
+    const size_t window = ( mPlaying ? ANIMATION_LOOKAHEAD : 0 );
+    set< ExtRect > stale;
+    set< ExtRect >* const queues[] = { &mQueuedRects, &mPrefetchRects };
+    for( set< ExtRect >* queued : queues )
+    {
+        for( set< ExtRect >::iterator it = queued->begin(); it != queued->end(); )
+        {
+            const ExtRect& rect = *it;
+            bool wanted = false;
+            for( size_t ahead = 0; ahead <= window && ahead < mFrames.size() && !wanted; ++ahead )
+            {
+                const size_t frame = ( mCurFrame + ahead ) % mFrames.size();
+                wanted = ( rect == GetTile( frame, get<1>( rect ), get<2>( rect ), mScale ) );
+            }
+
+            if( wanted )
+            {
+                ++it;
+                continue;
+            }
+
+            stale.insert( rect );
+            queued->erase( it++ );
+        }
     }
 
-    SetImage( mFrames[ mCurFrame ].mImage );
+    // any of them already being rendered still come back, and get cached
+    mImageFactory.RemoveRects( stale );
+}
+
+void wxImagePanel::SetFrameSink( wxEvtHandler* sink )
+{
+    // frames all share one source, but nothing says they have to
+    set< FrameSource* > sources;
+    for( const AnimationFrame& frame : mFrames )
+    {
+        if( NULL != frame.mSource && sources.insert( frame.mSource.get() ).second )
+            frame.mSource->SetEventSink( sink, mFrameEventId );
+    }
+}
+
+
+void wxImagePanel::QueueFramesAhead()
+{
+    if( !mPlaying || !AnimationFits() )
+        return;
+
+    const int filter = GetFilterLadder( mScale ).back();
+    const vector< wxRect > visibleRects = GetCoverage
+        (
+        wxRect( mPosition, GetSize() ),
+        wxRect( wxPoint( 0, 0 ), mImageSize * mScale ),
+        wxSize( TILE_SIZE, TILE_SIZE )
+        );
+
+    for( size_t ahead = 1; ahead <= ANIMATION_LOOKAHEAD && ahead < mFrames.size(); ++ahead )
+    {
+        // asking also gets the source going on it
+        const size_t frame = ( mCurFrame + ahead ) % mFrames.size();
+        if( !ResolveFrame( frame ) )
+            break;
+
+        for( const wxRect& rect : visibleRects )
+        {
+            // unchanged tiles come from an earlier frame, likely already cached
+            const ExtRect extRect = GetTile( frame, filter, rect, mScale );
+
+            wxBitmapPtr bmpPtr;
+            if( mBitmapCache.get( bmpPtr, ScaledRect( mScale, extRect ), false ) )
+                continue;
+            if( mQueuedRects.count( extRect ) > 0 || mPrefetchRects.count( extRect ) > 0 )
+                continue;
+
+            // only what actually gets queued can come back and clear
+            // mPrefetchRects again
+            if( !ResolveFrame( get<0>( extRect ) ) )
+                continue;
+
+            mPrefetchRects.insert( extRect );
+            mImageFactory.AddFrameRect( extRect, mFrames[ get<0>( extRect ) ] );
+            mSpeculativeRects.clear();
+        }
+    }
+}
+
+
+ExtRect wxImagePanel::GetTile( size_t frame, int filter, const wxRect& rect, double scale )
+{
+    const wxRect srcRect = ScaledImageFactory::GetSourceRect( ExtRect( frame, filter, rect ), scale );
+    return ExtRect( mFrameHashes.GetSourceFrame( frame, srcRect ), filter, rect );
+}
+
+
+bool wxImagePanel::AnimationFits() const
+{
+    // a quick tile and a good one per visible tile per frame, counting
+    // the partial tiles along the edges as whole ones
+    const size_t tiles = ( GetSize().x / TILE_SIZE + 2 ) * ( GetSize().y / TILE_SIZE + 2 );
+    const size_t bytes = mFrames.size() * tiles * 2 * TILE_SIZE * TILE_SIZE * 4;
+    return bytes <= BITMAP_CACHE_BYTES;
 }
 
 void wxImagePanel::OnAnimationTimer( wxTimerEvent& WXUNUSED( event ) )
 {
-    IncrementFrame( true );
-    Play( false );
+    // otherwise OnThread() picks playback back up once the frame is in
+    if( IncrementFrame( true ) )
+        Play( false );
 }
 
 void wxImagePanel::OnKeyboardTimer( wxTimerEvent& WXUNUSED( event ) )
@@ -483,17 +1120,17 @@ void wxImagePanel::SetZoomType( const Zoom::Type zoomType )
 {
     mZoomType = zoomType;
 
-    const double scaleWidth = ( GetSize().x / static_cast< double >( mImage->GetWidth() ) );
-    const double scaleHeight = ( GetSize().y / static_cast< double >( mImage->GetHeight() ) );
+    const double scaleWidth = ( GetSize().x / static_cast< double >( mImageSize.GetWidth() ) );
+    const double scaleHeight = ( GetSize().y / static_cast< double >( mImageSize.GetHeight() ) );
 
     switch( mZoomType )
     {
     case Zoom::In:
-        SetScale( mScale * 1.1 );
+        SetScale( mScale * ZOOM_STEP );
         mZoomType = Zoom::Previous;
         break;
     case Zoom::Out:
-        SetScale( mScale / 1.1 );
+        SetScale( mScale / ZOOM_STEP );
         mZoomType = Zoom::Previous;
         break;
     default:
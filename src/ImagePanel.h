@@ -2,23 +2,30 @@
 #define IMAGEPANEL_H
 
 #include <wx/wx.h>
+#include <wx/stopwatch.h>
 
 #include <memory>
 #include <map>
 #include <set>
+#include <vector>
+#include <functional>
 
 #include "ScaledImageFactory.h"
 #include "LruCache.h"
+#include "FrameHashes.h"
+#include "AnimationFrame.h"
 
 
-struct AnimationFrame
-{
-    wxSharedPtr< wxImage > mImage;
+// a tile at some scale
+typedef std::pair< double, ExtRect > ScaledRect;
 
-    // in milliseconds
-    int mDelay;
+struct ScaledRectHash
+{
+    size_t operator()( const ScaledRect& rect ) const
+    {
+        return ExtRectHash()( rect.second ) ^ std::hash< double >()( rect.first );
+    }
 };
-typedef std::vector< AnimationFrame > AnimationFrames;
 
 class wxImagePanel : public wxWindow
 {
@@ -38,14 +45,15 @@ public:
         };
     };
 
-    wxImagePanel( wxWindow* parent );
+    wxImagePanel( wxWindow* parent, const ScaledImageFactory::WorkerOptions& workerOptions = ScaledImageFactory::WorkerOptions() );
+    ~wxImagePanel();
 
     void SetImages( const AnimationFrames& newImages );
     void SetZoomType( const Zoom::Type zoomType );
 
 private:
     void SetScale( const double newScale );
-    void SetImage( wxSharedPtr< wxImage > newImage );
+    void SetImage( const AnimationFrame& frame );
 
     void OnSize( wxSizeEvent& event );
     void OnButtonDown( wxMouseEvent& event );
@@ -58,22 +66,105 @@ private:
     void OnThread( wxThreadEvent& event );
     void OnAnimationTimer( wxTimerEvent& event );
     void OnKeyboardTimer( wxTimerEvent& event );
+    void OnDeliveryTimer( wxTimerEvent& event );
+    void OnTopLevelMove( wxMoveEvent& event );
+    void OnDisplayChanged( wxDisplayChangedEvent& event );
+
+    // pulls finished tiles out of the factory, caches and draws them
+    void DeliverResults();
+
+    // milliseconds between display refreshes, looked up again only
+    // once the window moves or the displays change
+    int GetRefreshInterval();
 
     wxPoint ClampPosition( const wxPoint& newPos );
     void ScrollToPosition( const wxPoint& newPos );
-    void QueueRect( const ExtRect& rect );
+    void QueueRects( const std::vector< ExtRect >& rects, bool prefetch = false );
+
+    // queues low-priority tiles where the viewport is headed, looking
+    // further ahead the faster we pan and the more workers are idle
+    void Prefetch();
+    void UpdatePanVelocity( const wxPoint& delta );
+
+    // filters to render tiles with at scale, lowest quality first
+    std::vector< int > GetFilterLadder( const double scale ) const;
+
+    // where the viewport would end up if we zoomed to newScale
+    wxPoint GetPositionForScale( const double newScale ) const;
+
+    // renders the viewport at the next zoom step in and out while
+    // there's nothing else to do
+    void Speculate();
 
     void Play( bool pause );
-    void IncrementFrame( bool forward );
+
+    // queues the best tier of the visible tiles for the next few frames
+    // while an animation is playing
+    void QueueFramesAhead();
+
+    // the tile covering rect of frame at scale, which belongs to an
+    // earlier frame if the pixels under it haven't changed since
+    ExtRect GetTile( size_t frame, int filter, const wxRect& rect, double scale );
+
+    // true if every frame's visible tiles fit in mBitmapCache, so a
+    // looping animation can play from the cache after the first time through
+    bool AnimationFits() const;
+
+    // returns false if the frame it moved to isn't ready yet, in which
+    // case it gets shown once it is
+    bool IncrementFrame( bool forward );
+
+    // fills in mFrames[ frame ] from its source if it's ready by now
+    bool ResolveFrame( size_t frame );
+    bool ShowFrame( size_t frame );
+
+    // forgets queued tiles that neither the current frame nor, while
+    // playing, the ones queued ahead of it have any use for anymore
+    void DropStaleFrames();
+
+    // points the sources of mFrames at us, or at nothing
+    void SetFrameSink( wxEvtHandler* sink );
 
     static const size_t TILE_SIZE = 256;   // pixels
+    static const size_t MAX_BAND_TILES = 4;
+    static const size_t BITMAP_CACHE_BYTES = 256 * 1024 * 1024;
+    static const size_t ANIMATION_LOOKAHEAD = 4;   // frames
+    static const int PREFETCH_TIME = 300;      // milliseconds of panning to look ahead
+    static const int MIN_PREFETCH = 16;        // pixels
+    static const int PAN_TIMEOUT = 100;        // milliseconds between moves before we count it as stopped
 
     size_t mCurFrame;
     AnimationFrames mFrames;
-    wxSharedPtr< wxImage > mImage;
+
+    // frame to show as soon as its source has it, mFrames.size() if none
+    size_t mPendingFrame;
+    // id of the events frame sources send when one is ready
+    int mFrameEventId;
+    FrameHashes mFrameHashes;
+    wxSize mImageSize;
 
     typedef wxSharedPtr< wxBitmap > wxBitmapPtr;
-    LruCache< ExtRect, wxBitmapPtr > mBitmapCache;
+
+    // bytes a cached tile takes up, give or take
+    struct BitmapCost
+    {
+        size_t operator()( const wxBitmapPtr& bmp ) const
+        {
+            return static_cast< size_t >( bmp->GetWidth() ) * bmp->GetHeight() * 4;
+        }
+    };
+    // tiles from every scale we've been at lately, so going back to one
+    // is instant and the others can stand in while a new one renders
+    LruCache< ScaledRect, wxBitmapPtr, ScaledRectHash, BitmapCost > mBitmapCache;
+
+    // scales with tiles in mBitmapCache, most recent first
+    std::vector< double > mRecentScales;
+    static const size_t MAX_RECENT_SCALES = 8;
+    void AddRecentScale( const double scale );
+
+    // covers rect, which has nothing at the current scale, with stretched
+    // tiles from the closest recent scale that has any
+    void DrawPlaceholder( wxDC& dc, const wxRect& rect );
 
     // position of the top-left of the viewport
     wxPoint mPosition;
@@ -82,12 +173,35 @@ private:
     wxPoint mLeftPositionStart;
     wxPoint mLeftMouseStart;
 
+    // smoothed panning speed in pixels per millisecond
+    wxRealPoint mPanVelocity;
+    wxStopWatch mPanWatch;
+
     ScaledImageFactory mImageFactory;
+    // tiles queued for the viewport; once they're all in, the next
+    // quality tier or speculation can start
     std::set< ExtRect > mQueuedRects;
 
+    // tiles queued before they're needed, where we're panning to
+    // or for the frames coming up, which nothing waits on
+    std::set< ExtRect > mPrefetchRects;
+
+    // tiles queued for the adjacent zoom steps
+    std::set< ScaledRect > mSpeculativeRects;
+
     wxTimer mAnimationTimer;
+    // the timer is one-shot, so it isn't running while it's being handled
+    bool mPlaying;
     wxTimer mKeyboardTimer;
 
+    // paces DeliverResults() to the display refresh rate
+    wxTimer mDeliveryTimer;
+    wxStopWatch mDeliveryWatch;
+    // 0 until looked up
+    int mRefreshInterval;
+    // moves of ours only come from our parent
+    wxWindow* mTopLevel;
+
     Zoom::Type mZoomType;
 };
 
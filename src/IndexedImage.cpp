@@ -0,0 +1,114 @@
+#include "IndexedImage.h"
+#include "TileKernels.h"
+
+using namespace std;
+
+
+// maps RGBA colors to palette indices while an image is being indexed
+// open addressing with 4x as many slots as colors keeps probes short
+class ColorTable
+{
+public:
+    ColorTable()
+        : mKeys( SLOTS, 0 ), mIndices( SLOTS, 0 ), mUsed( SLOTS, false ), mCount( 0 )
+    { }
+
+    // returns false once there's no room for another color
+    bool Find( const unsigned int color, unsigned char& index )
+    {
+        size_t slot = ( color * 2654435761U ) >> ( 32 - SLOT_BITS );
+        while( mUsed[ slot ] )
+        {
+            if( mKeys[ slot ] == color )
+            {
+                index = mIndices[ slot ];
+                return true;
+            }
+            slot = ( slot + 1 ) & ( SLOTS - 1 );
+        }
+
+        if( mCount == IndexedImage::PALETTE_SIZE )
+            return false;
+
+        mUsed[ slot ] = true;
+        mKeys[ slot ] = color;
+        mIndices[ slot ] = static_cast< unsigned char >( mCount );
+        index = mIndices[ slot ];
+        mCount++;
+        return true;
+    }
+
+private:
+    static const size_t SLOT_BITS = 10;
+    static const size_t SLOTS = 1 << SLOT_BITS;
+
+    vector< unsigned int > mKeys;
+    vector< unsigned char > mIndices;
+    vector< bool > mUsed;
+    size_t mCount;
+};
+
+
+IndexedImagePtr IndexedImage::Create( const wxImage& image )
+{
+    const size_t pixels = static_cast< size_t >( image.GetWidth() ) * image.GetHeight();
+    const unsigned char* rgb = image.GetData();
+    const unsigned char* alpha = image.HasAlpha() ? image.GetAlpha() : NULL;
+
+    IndexedImagePtr indexed( new IndexedImage );
+    indexed->mSize = image.GetSize();
+    indexed->mHasAlpha = ( NULL != alpha );
+    indexed->mIndices.resize( pixels );
+    indexed->mPalette.assign( PALETTE_SIZE * 4, 255 );
+
+    ColorTable table;
+    unsigned int lastColor = 0;
+    unsigned char lastIndex = 0;
+    bool haveLast = false;
+    for( size_t i = 0; i < pixels; ++i )
+    {
+        const unsigned int color =
+            ( static_cast< unsigned int >( rgb[ i * 3 + 0 ] ) << 24 ) |
+            ( static_cast< unsigned int >( rgb[ i * 3 + 1 ] ) << 16 ) |
+            ( static_cast< unsigned int >( rgb[ i * 3 + 2 ] ) << 8 ) |
+            ( NULL != alpha ? alpha[ i ] : 255U );
+
+        // runs of the same color are the common case
+        if( !haveLast || color != lastColor )
+        {
+            if( !table.Find( color, lastIndex ) )
+                return IndexedImagePtr();
+
+            unsigned char* entry = &indexed->mPalette[ lastIndex * 4 ];
+            entry[ 0 ] = static_cast< unsigned char >( color >> 24 );
+            entry[ 1 ] = static_cast< unsigned char >( color >> 16 );
+            entry[ 2 ] = static_cast< unsigned char >( color >> 8 );
+            entry[ 3 ] = static_cast< unsigned char >( color );
+            lastColor = color;
+            haveLast = true;
+        }
+
+        indexed->mIndices[ i ] = lastIndex;
+    }
+
+    return indexed;
+}
+
+wxSharedPtr< wxImage > IndexedImage::ToImage() const
+{
+    const size_t w = static_cast< size_t >( mSize.GetWidth() );
+    const size_t h = static_cast< size_t >( mSize.GetHeight() );
+
+    wxSharedPtr< wxImage > image( new wxImage( mSize, false ) );
+    if( mHasAlpha )
+        image->SetAlpha( NULL );
+
+    for( size_t y = 0; y < h; ++y )
+    {
+        const unsigned char* row = &mIndices[ y * w ];
+        PaletteRow( &image->GetData()[ y * w * 3 ], row, GetPalette(), w, 3 );
+        if( mHasAlpha )
+            PaletteRow( &image->GetAlpha()[ y * w ], row, GetPalette(), w, 1 );
+    }
+    return image;
+}
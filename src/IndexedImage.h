@@ -0,0 +1,48 @@
+#ifndef INDEXEDIMAGE_H
+#define INDEXEDIMAGE_H
+
+#include <wx/sharedptr.h>
+#include <wx/image.h>
+
+#include <vector>
+
+
+// an image stored as one 8-bit palette index per pixel, for the frames
+// of GIFs and other palette-based animations; the tile kernels look the
+// colors up as they read, so it never gets expanded as a whole
+class IndexedImage
+{
+public:
+    static const size_t PALETTE_SIZE = 256;
+
+    // returns NULL if image has more than PALETTE_SIZE distinct colors
+    static wxSharedPtr< IndexedImage > Create( const wxImage& image );
+
+    const wxSize& GetSize() const                   { return mSize; }
+    int GetWidth() const                            { return mSize.GetWidth(); }
+    int GetHeight() const                           { return mSize.GetHeight(); }
+    bool HasAlpha() const                           { return mHasAlpha; }
+
+    // row-major, one index per pixel
+    const unsigned char* GetIndices() const         { return &mIndices[ 0 ]; }
+
+    // PALETTE_SIZE RGBA entries; alpha is 255 throughout unless HasAlpha()
+    const unsigned char* GetPalette() const         { return &mPalette[ 0 ]; }
+
+    size_t GetBytes() const                         { return mIndices.size() + mPalette.size(); }
+
+    // expands the whole thing, for the odd thing that needs plain pixels
+    wxSharedPtr< wxImage > ToImage() const;
+
+private:
+    IndexedImage() { }
+
+    wxSize mSize;
+    bool mHasAlpha;
+    std::vector< unsigned char > mIndices;
+    std::vector< unsigned char > mPalette;
+};
+
+typedef wxSharedPtr< IndexedImage > IndexedImagePtr;
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef LOCKFREERING_H
+#define LOCKFREERING_H
+
+#include <cstddef>
+#include <atomic>
+
+
+// bounded multi-producer/multi-consumer FIFO that never takes a lock
+// every cell carries a sequence number saying whose turn it is, so a
+// producer and a consumer only ever race on the two position counters
+// (Dmitry Vyukov's bounded MPMC queue)
+template< typename T >
+class LockFreeRing
+{
+public:
+    // capacity must be a power of two
+    LockFreeRing( size_t capacity )
+        : mCells( new Cell[ capacity ] ), mMask( capacity - 1 ), mPushPos( 0 ), mPopPos( 0 )
+    {
+        for( size_t i = 0; i < capacity; ++i )
+        {
+            mCells[ i ].mSequence.store( i, std::memory_order_relaxed );
+        }
+    }
+
+    ~LockFreeRing()
+    {
+        delete [] mCells;
+    }
+
+    // returns false if the ring is full
+    bool TryPush( const T& item )
+    {
+        Cell* cell = NULL;
+        size_t pos = mPushPos.load( std::memory_order_relaxed );
+        while( true )
+        {
+            cell = &mCells[ pos & mMask ];
+            const size_t seq = cell->mSequence.load( std::memory_order_acquire );
+            const ptrdiff_t diff = static_cast< ptrdiff_t >( seq ) - static_cast< ptrdiff_t >( pos );
+            if( 0 == diff )
+            {
+                if( mPushPos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+                    break;
+            }
+            else if( diff < 0 )
+            {
+                return false;
+            }
+            else
+            {
+                pos = mPushPos.load( std::memory_order_relaxed );
+            }
+        }
+
+        cell->mItem = item;
+        cell->mSequence.store( pos + 1, std::memory_order_release );
+        return true;
+    }
+
+    // returns false if the ring is empty
+    bool TryPop( T& item )
+    {
+        Cell* cell = NULL;
+        size_t pos = mPopPos.load( std::memory_order_relaxed );
+        while( true )
+        {
+            cell = &mCells[ pos & mMask ];
+            const size_t seq = cell->mSequence.load( std::memory_order_acquire );
+            const ptrdiff_t diff = static_cast< ptrdiff_t >( seq ) - static_cast< ptrdiff_t >( pos + 1 );
+            if( 0 == diff )
+            {
+                if( mPopPos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+                    break;
+            }
+            else if( diff < 0 )
+            {
+                return false;
+            }
+            else
+            {
+                pos = mPopPos.load( std::memory_order_relaxed );
+            }
+        }
+
+        item = cell->mItem;
+
+        // don't keep whatever the item owns alive until the cell gets reused
+        cell->mItem = T();
+        cell->mSequence.store( pos + mMask + 1, std::memory_order_release );
+        return true;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic< size_t > mSequence;
+        T mItem;
+    };
+
+    Cell* mCells;
+    const size_t mMask;
+
+    // kept apart so producers and consumers don't share a cache line
+    char mPad0[ 64 ];
+    std::atomic< size_t > mPushPos;
+    char mPad1[ 64 ];
+    std::atomic< size_t > mPopPos;
+
+    // no copy ctor/assignment operator
+    LockFreeRing( const LockFreeRing& );
+    LockFreeRing& operator=( const LockFreeRing& );
+};
+
+#endif
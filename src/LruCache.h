@@ -1,81 +1,232 @@
 #ifndef LRUCACHE_H
 #define LRUCACHE_H
 
-#include <cassert>
-#include <list>
-#include <map>
+#include <cstddef>
+#include <vector>
 #include <functional>
 
-// adapted from http://stackoverflow.com/a/25093143/44729
-template< typename K, typename V, class Comp = std::less< K > >
+
+// charges one unit per entry, so the capacity is an entry count
+template< typename V >
+struct UnitCost
+{
+    size_t operator()( const V& ) const { return 1; }
+};
+
+// least-recently-used cache holding up to a capacity's worth of values,
+// as measured by Cost
+// entries live in pooled nodes that are both hash chain links and LRU
+// list links, so lookups and updates are O(1) and once the pool has grown
+// to the working set nothing gets allocated anymore
+template
+    <
+    typename K,
+    typename V,
+    class Hash,
+    class Cost = UnitCost< V >,
+    class Equal = std::equal_to< K >
+    >
 class LruCache
 {
 public:
-    LruCache( size_t aCapacity )
-        : mCapacity( aCapacity )
-    { }
+    LruCache( size_t aCapacity, const Cost& aCost = Cost(), const Hash& aHash = Hash() )
+        : mCapacity( aCapacity ), mUsed( 0 ), mCount( 0 )
+        , mFree( NULL ), mCost( aCost ), mHash( aHash )
+    {
+        mHead.mPrev = mHead.mNext = &mHead;
+        mBuckets.resize( MIN_BUCKETS, NULL );
+    }
+
+    ~LruCache()
+    {
+        for( size_t i = 0; i < mChunks.size(); ++i )
+        {
+            delete [] mChunks[ i ];
+        }
+    }
 
-    // insert a new key-value pair in the cache
+    // insert a new key-value pair in the cache, evicting the
+    // least-recently used entries until it fits
     bool insert( const K& aKey, const V& aValue )
     {
-        if( mCache.find( aKey ) != mCache.end() )
+        Node** slot = Find( aKey );
+        if( NULL != *slot )
             return false;
 
-        // make space if necessary
-        if( mList.size() == mCapacity )
+        const size_t cost = mCost( aValue );
+        while( mCount > 0 && mUsed + cost > mCapacity )
         {
-            // Purge the least-recently used element in the cache
-            // identify least-recently-used key
-            const typename Cache::iterator it = mCache.find( mList.front() );
-
-            //erase both elements to completely purge record
-            mCache.erase( it );
-            mList.pop_front();
+            Evict( mHead.mNext );
         }
 
-        // record k as most-recently-used key
-        typename List::iterator it = mList.insert( mList.end(), aKey );
+        // the eviction may have unlinked the chain we found
+        if( mCount + 1 > mBuckets.size() )
+            Rehash( mBuckets.size() * 2 );
+        slot = Find( aKey );
+
+        Node* node = Allocate();
+        node->mKey = aKey;
+        node->mValue = aValue;
+        node->mCost = cost;
+        node->mChain = NULL;
+        *slot = node;
+        LinkBack( node );
 
-        // create key-value entry, linked to the usage record
-        mCache.insert( std::make_pair( aKey, std::make_pair( aValue, it ) ) );
+        mUsed += cost;
+        mCount++;
         return true;
     }
 
     bool get( V& aValue, const K& aKey, const bool updateUsage = true )
     {
-        // cache-miss: did not find the key
-        typename Cache::iterator it = mCache.find( aKey );
-        if( it == mCache.end() )
+        Node* node = *Find( aKey );
+        if( NULL == node )
             return false;
 
         if( updateUsage )
         {
-            // cache-hit
-            // Update access record by moving accessed key to back of the list
-            mList.splice( mList.end(), mList, (it)->second.second );
+            // move to the most-recently used end
+            Unlink( node );
+            LinkBack( node );
         }
 
-        // return the retrieved value
-        aValue = (it)->second.first;
+        aValue = node->mValue;
+        return true;
+    }
+
+    bool erase( const K& aKey )
+    {
+        Node* node = *Find( aKey );
+        if( NULL == node )
+            return false;
+
+        Evict( node );
         return true;
     }
 
     void clear()
     {
-        mCache.clear();
-        mList.clear();
+        while( mCount > 0 )
+        {
+            Evict( mHead.mNext );
+        }
     }
 
+    size_t size() const { return mCount; }
+    size_t cost() const { return mUsed; }
+
 private:
+    struct Node
+    {
+        K mKey;
+        V mValue;
+        size_t mCost;
+
+        // LRU list, least-recently used at mHead.mNext
+        Node* mPrev;
+        Node* mNext;
+
+        // next node in the same bucket, or in the free list
+        Node* mChain;
+    };
+
+    static const size_t MIN_BUCKETS = 64;      // power of two
+    static const size_t CHUNK_NODES = 256;
+
+    // the link pointing at aKey's node, or at the NULL ending its chain
+    Node** Find( const K& aKey )
+    {
+        Node** link = &mBuckets[ mHash( aKey ) & ( mBuckets.size() - 1 ) ];
+        while( NULL != *link && !mEqual( ( *link )->mKey, aKey ) )
+        {
+            link = &( *link )->mChain;
+        }
+        return link;
+    }
+
+    void Evict( Node* node )
+    {
+        Node** link = Find( node->mKey );
+        *link = node->mChain;
+        Unlink( node );
+
+        mUsed -= node->mCost;
+        mCount--;
+
+        // don't keep whatever the value owns alive in the pool
+        node->mValue = V();
+        node->mChain = mFree;
+        mFree = node;
+    }
+
+    Node* Allocate()
+    {
+        if( NULL == mFree )
+        {
+            Node* chunk = new Node[ CHUNK_NODES ];
+            mChunks.push_back( chunk );
+            for( size_t i = 0; i < CHUNK_NODES; ++i )
+            {
+                chunk[ i ].mChain = mFree;
+                mFree = &chunk[ i ];
+            }
+        }
+
+        Node* node = mFree;
+        mFree = node->mChain;
+        return node;
+    }
+
+    void Rehash( size_t buckets )
+    {
+        std::vector< Node* > old( buckets, static_cast< Node* >( NULL ) );
+        old.swap( mBuckets );
+        for( size_t i = 0; i < old.size(); ++i )
+        {
+            Node* node = old[ i ];
+            while( NULL != node )
+            {
+                Node* next = node->mChain;
+                Node*& bucket = mBuckets[ mHash( node->mKey ) & ( mBuckets.size() - 1 ) ];
+                node->mChain = bucket;
+                bucket = node;
+                node = next;
+            }
+        }
+    }
+
+    void Unlink( Node* node )
+    {
+        node->mPrev->mNext = node->mNext;
+        node->mNext->mPrev = node->mPrev;
+    }
+
+    void LinkBack( Node* node )
+    {
+        node->mPrev = mHead.mPrev;
+        node->mNext = &mHead;
+        mHead.mPrev->mNext = node;
+        mHead.mPrev = node;
+    }
+
     size_t mCapacity;
+    size_t mUsed;
+    size_t mCount;
+
+    // sentinel of the circular LRU list
+    Node mHead;
+
+    std::vector< Node* > mBuckets;
+    std::vector< Node* > mChunks;
+    Node* mFree;
 
-    // Key access history, most recent at back
-    typedef std::list< K > List;
-    List mList;
+    Cost mCost;
+    Hash mHash;
+    Equal mEqual;
 
-    // Key to value and key history iterator
-    typedef std::map< K, std::pair< V, typename List::iterator >, Comp > Cache;
-    Cache mCache;
+    // no copy ctor/assignment operator
+    LruCache( const LruCache& );
+    LruCache& operator=( const LruCache& );
 };
 
-#endif
+#endif
\ No newline at end of file
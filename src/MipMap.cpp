@@ -0,0 +1,212 @@
+#include "MipMap.h"
+#include "TileKernels.h"
+
+using namespace std;
+
+
+// box-filters a single plane of interleaved samples down by 2 in each
+// dimension; odd trailing rows/columns are averaged with themselves
+void Downsample
+    (
+    unsigned char* dst,
+    const unsigned char* src,
+    const size_t srcW,
+    const size_t srcH,
+    const size_t channels
+    )
+{
+    const size_t dstW = ( srcW + 1 ) / 2;
+    const size_t dstH = ( srcH + 1 ) / 2;
+
+    for( size_t dstY = 0; dstY < dstH; ++dstY )
+    {
+        const size_t srcY0 = dstY * 2;
+        const size_t srcY1 = min( srcY0 + 1, srcH - 1 );
+        const unsigned char* row0 = &src[ srcY0 * srcW * channels ];
+        const unsigned char* row1 = &src[ srcY1 * srcW * channels ];
+
+        unsigned char* dstRow = &dst[ dstY * dstW * channels ];
+
+        for( size_t dstX = 0; dstX < dstW; ++dstX )
+        {
+            const size_t srcX0 = dstX * 2;
+            const size_t srcX1 = min( srcX0 + 1, srcW - 1 );
+            for( size_t c = 0; c < channels; ++c )
+            {
+                const unsigned int sum =
+                    row0[ srcX0 * channels + c ] + row0[ srcX1 * channels + c ] +
+                    row1[ srcX0 * channels + c ] + row1[ srcX1 * channels + c ];
+                dstRow[ dstX * channels + c ] = static_cast< unsigned char >( ( sum + 2 ) >> 2 );
+            }
+        }
+    }
+}
+
+
+// computes the min/max alpha of each blockSize x blockSize block
+void SummarizeAlpha
+    (
+    std::vector< unsigned char >& blockMin,
+    std::vector< unsigned char >& blockMax,
+    const unsigned char* alpha,
+    const size_t w,
+    const size_t h,
+    const size_t blockSize
+    )
+{
+    const size_t blocksX = ( w + blockSize - 1 ) / blockSize;
+    const size_t blocksY = ( h + blockSize - 1 ) / blockSize;
+    blockMin.assign( blocksX * blocksY, 255 );
+    blockMax.assign( blocksX * blocksY, 0 );
+
+    for( size_t y = 0; y < h; ++y )
+    {
+        const unsigned char* row = &alpha[ y * w ];
+        unsigned char* rowMin = &blockMin[ ( y / blockSize ) * blocksX ];
+        unsigned char* rowMax = &blockMax[ ( y / blockSize ) * blocksX ];
+        for( size_t x = 0; x < w; ++x )
+        {
+            const size_t block = x / blockSize;
+            rowMin[ block ] = min( rowMin[ block ], row[ x ] );
+            rowMax[ block ] = max( rowMax[ block ], row[ x ] );
+        }
+    }
+}
+
+
+MipMap::MipMap( const AnimationFrame& base )
+    : mIndexedBase( base.mIndexed )
+    , mBaseBytes( base.GetBytes() )
+{
+    const bool hasAlpha = ( NULL != base.mIndexed ) ? base.mIndexed->HasAlpha() : base.mImage->HasAlpha();
+    size_t w = static_cast< size_t >( base.GetSize().GetWidth() );
+    size_t h = static_cast< size_t >( base.GetSize().GetHeight() );
+
+    mLevels.push_back( Level() );
+    mLevels.back().mImage = base.mImage;
+    mLevels.back().mSize = base.GetSize();
+    mLevels.back().mHasAlpha = hasAlpha;
+    mLevels.back().mBlocksX = 0;
+    while( w > 1 || h > 1 )
+    {
+        w = ( w + 1 ) / 2;
+        h = ( h + 1 ) / 2;
+        mLevels.push_back( Level() );
+        mLevels.back().mSize = wxSize( w, h );
+        mLevels.back().mHasAlpha = hasAlpha;
+        mLevels.back().mBlocksX = 0;
+    }
+}
+
+void MipMap::BuildLevel( size_t level )
+{
+    Level& dstLevel = mLevels[ level ];
+    if( 0 == level && NULL != mIndexedBase )
+    {
+        // alpha gets summarized straight from the indices, a row at a time
+        if( dstLevel.mHasAlpha && dstLevel.mAlphaMin.empty() )
+        {
+            const size_t w = static_cast< size_t >( dstLevel.mSize.GetWidth() );
+            const size_t h = static_cast< size_t >( dstLevel.mSize.GetHeight() );
+            const size_t blockSize = BLOCK_SIZE;
+            vector< unsigned char > alpha( w * blockSize );
+            dstLevel.mBlocksX = ( w + blockSize - 1 ) / blockSize;
+            for( size_t y = 0; y < h; y += blockSize )
+            {
+                const size_t rows = min( blockSize, h - y );
+                for( size_t i = 0; i < rows; ++i )
+                {
+                    PaletteRow( &alpha[ i * w ], &mIndexedBase->GetIndices()[ ( y + i ) * w ], mIndexedBase->GetPalette(), w, 1 );
+                }
+
+                vector< unsigned char > blockMin;
+                vector< unsigned char > blockMax;
+                SummarizeAlpha( blockMin, blockMax, &alpha[ 0 ], w, rows, BLOCK_SIZE );
+                dstLevel.mAlphaMin.insert( dstLevel.mAlphaMin.end(), blockMin.begin(), blockMin.end() );
+                dstLevel.mAlphaMax.insert( dstLevel.mAlphaMax.end(), blockMax.begin(), blockMax.end() );
+            }
+        }
+        return;
+    }
+
+    if( NULL == dstLevel.mImage )
+    {
+        // level 1 of an indexed base comes from a throwaway expansion of it
+        const wxImagePtr srcImage = ( 1 == level && NULL != mIndexedBase ) ? mIndexedBase->ToImage() : mLevels[ level - 1 ].mImage;
+        const wxImage& src = *srcImage;
+        const size_t srcW = static_cast< size_t >( src.GetWidth() );
+        const size_t srcH = static_cast< size_t >( src.GetHeight() );
+
+        wxImagePtr dst( new wxImage( ( srcW + 1 ) / 2, ( srcH + 1 ) / 2, false ) );
+        Downsample( dst->GetData(), src.GetData(), srcW, srcH, 3 );
+        if( src.HasAlpha() )
+        {
+            dst->SetAlpha( NULL );
+            Downsample( dst->GetAlpha(), src.GetAlpha(), srcW, srcH, 1 );
+        }
+
+        dstLevel.mImage = dst;
+    }
+
+    const wxImage& image = *dstLevel.mImage;
+    if( image.HasAlpha() && dstLevel.mAlphaMin.empty() )
+    {
+        const size_t w = static_cast< size_t >( image.GetWidth() );
+        const size_t h = static_cast< size_t >( image.GetHeight() );
+        SummarizeAlpha( dstLevel.mAlphaMin, dstLevel.mAlphaMax, image.GetAlpha(), w, h, BLOCK_SIZE );
+        dstLevel.mBlocksX = ( w + BLOCK_SIZE - 1 ) / BLOCK_SIZE;
+    }
+}
+
+MipMap::wxImagePtr MipMap::GetLevel( size_t level )
+{
+    if( level >= mLevels.size() )
+        level = mLevels.size() - 1;
+
+    wxMutexLocker locker( mMutex );
+
+    for( size_t i = 0; i <= level; ++i )
+    {
+        BuildLevel( i );
+    }
+
+    return mLevels[ level ].mImage;
+}
+
+Alpha::Type MipMap::GetAlphaType( size_t level, const wxRect& rect ) const
+{
+    const Level& lvl = mLevels[ level ];
+    if( !lvl.mHasAlpha )
+        return Alpha::Opaque;
+
+    const wxRect clipped = rect.Intersect( wxRect( wxPoint( 0, 0 ), lvl.mSize ) );
+    if( clipped.IsEmpty() )
+        return Alpha::Mixed;
+
+    unsigned char lo = 255;
+    unsigned char hi = 0;
+    for( size_t y = clipped.GetTop() / BLOCK_SIZE; y <= clipped.GetBottom() / BLOCK_SIZE; ++y )
+    {
+        for( size_t x = clipped.GetLeft() / BLOCK_SIZE; x <= clipped.GetRight() / BLOCK_SIZE; ++x )
+        {
+            lo = min( lo, lvl.mAlphaMin[ y * lvl.mBlocksX + x ] );
+            hi = max( hi, lvl.mAlphaMax[ y * lvl.mBlocksX + x ] );
+        }
+    }
+
+    if( lo == 255 )
+        return Alpha::Opaque;
+    if( hi == 0 )
+        return Alpha::Transparent;
+    return Alpha::Mixed;
+}
+
+size_t MipMap::GetLevelForScale( double scale ) const
+{
+    size_t level = 0;
+    while( level + 1 < mLevels.size() && scale * ( 2 << level ) <= 1.0 )
+    {
+        level++;
+    }
+    return level;
+}
@@ -0,0 +1,96 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <wx/sharedptr.h>
+#include <wx/image.h>
+#include <wx/thread.h>
+
+#include <vector>
+
+#include "AnimationFrame.h"
+
+
+// what the alpha channel looks like over some region
+struct Alpha
+{
+    enum Type
+    {
+        Opaque,
+        Transparent,
+        Mixed,
+    };
+};
+
+// power-of-two image pyramid, levels are built on demand
+// level N is the base image box-filtered down by 2^N (rounding up)
+// an indexed base stays indexed, only the levels below it are plain images
+class MipMap
+{
+public:
+    typedef wxSharedPtr< wxImage > wxImagePtr;
+
+    MipMap( const AnimationFrame& base );
+
+    // returns the requested level, building it (and any missing
+    // levels between it and the base) if necessary
+    // level 0 of an indexed base comes back NULL, see GetIndexedBase()
+    // safe to call from multiple threads
+    wxImagePtr GetLevel( size_t level );
+
+    // the base, if it's indexed
+    const IndexedImagePtr& GetIndexedBase() const
+    {
+        return mIndexedBase;
+    }
+
+    wxSize GetLevelSize( size_t level ) const
+    {
+        return mLevels[ level ].mSize;
+    }
+
+    // returns the coarsest level whose resolution is still
+    // at or above the given scale
+    size_t GetLevelForScale( double scale ) const;
+
+    size_t GetLevelCount() const
+    {
+        return mLevels.size();
+    }
+
+    // memory held by the base; the levels below it add about a third
+    size_t GetBaseBytes() const
+    {
+        return mBaseBytes;
+    }
+
+    // classifies the alpha of the given rect of a level
+    // the level must have been retrieved via GetLevel() first
+    Alpha::Type GetAlphaType( size_t level, const wxRect& rect ) const;
+
+private:
+    void BuildLevel( size_t level );
+
+    // alpha is summarized in blocks of this many pixels on a side
+    static const size_t BLOCK_SIZE = 32;
+
+    struct Level
+    {
+        wxImagePtr mImage;
+        wxSize mSize;
+        bool mHasAlpha;
+
+        // min/max alpha of each block, row-major
+        size_t mBlocksX;
+        std::vector< unsigned char > mAlphaMin;
+        std::vector< unsigned char > mAlphaMax;
+    };
+
+    wxMutex mMutex;
+    std::vector< Level > mLevels;
+    IndexedImagePtr mIndexedBase;
+    size_t mBaseBytes;
+};
+
+typedef wxSharedPtr< MipMap > MipMapPtr;
+
+#endif
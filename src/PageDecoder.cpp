@@ -0,0 +1,138 @@
+#include "PageDecoder.h"
+
+#include <wx/mstream.h>
+#include <wx/log.h>
+
+using namespace std;
+
+
+PageDecoder::PageDecoder( wxInputStream& stream, size_t count, size_t budget )
+    : mCount( count )
+    , mPages( budget )
+    , mCurrent( 0 ), mSink( NULL ), mSinkId( wxID_ANY ), mQuit( false )
+    , mChanged( mMutex )
+{
+    // the encoded file is a fraction of the decoded pages, keep it
+    // around so they can be thrown away and decoded again
+    vector< unsigned char > buffer( 64 * 1024 );
+    while( stream.Read( &buffer[ 0 ], buffer.size() ).LastRead() > 0 )
+    {
+        mData.insert( mData.end(), buffer.begin(), buffer.begin() + stream.LastRead() );
+    }
+
+    // the first page is wanted right now, there's no point in waiting
+    // for a thread to get to it
+    if( mCount > 0 )
+    {
+        mPages.insert( 0, Decode( 0 ) );
+        mTried.insert( 0 );
+    }
+
+    StartThreads( 1 );
+}
+
+PageDecoder::~PageDecoder()
+{
+    StopThreads( mMutex, mChanged, mQuit );
+}
+
+bool PageDecoder::GetFrame( size_t index, AnimationFrame& frame )
+{
+    wxMutexLocker locker( mMutex );
+    if( index != mCurrent )
+    {
+        mCurrent = index;
+        mTried.clear();
+        mChanged.Broadcast();
+    }
+
+    AnimationFrame page;
+    if( mPages.get( page, index ) )
+    {
+        frame.mImage = page.mImage;
+        frame.mIndexed = page.mIndexed;
+        return true;
+    }
+
+    // evicted since, have another go at it
+    mTried.erase( index );
+    mChanged.Broadcast();
+    return false;
+}
+
+void PageDecoder::SetEventSink( wxEvtHandler* sink, int id )
+{
+    wxMutexLocker locker( mMutex );
+    mSink = sink;
+    mSinkId = id;
+}
+
+size_t PageDecoder::GetBytes()
+{
+    wxMutexLocker locker( mMutex );
+    return mData.size() + mPages.cost();
+}
+
+wxThread::ExitCode PageDecoder::Entry()
+{
+    mMutex.Lock();
+    while( !mQuit )
+    {
+        const size_t page = GetNextPage();
+        if( page >= mCount )
+        {
+            mChanged.Wait();
+            continue;
+        }
+        mTried.insert( page );
+
+        mMutex.Unlock();
+        const AnimationFrame frame = Decode( page );
+        mMutex.Lock();
+        mPages.insert( page, frame );
+
+        // somebody's waiting on it
+        if( page == mCurrent && NULL != mSink )
+            wxQueueEvent( mSink, new wxThreadEvent( wxEVT_THREAD, mSinkId ) );
+    }
+    mMutex.Unlock();
+
+    return static_cast< wxThread::ExitCode >( 0 );
+}
+
+AnimationFrame PageDecoder::Decode( size_t index ) const
+{
+    wxMemoryInputStream stream( mData.empty() ? NULL : &mData[ 0 ], mData.size() );
+
+    wxSharedPtr< wxImage > image( new wxImage );
+    {
+        // bug workaround
+        // http://trac.wxwidgets.org/ticket/15331
+        wxLogNull logNo;
+        image->LoadFile( stream, wxBITMAP_TYPE_ANY, static_cast< int >( index ) );
+    }
+
+    AnimationFrame frame;
+    frame.mImage = image;
+    return frame;
+}
+
+size_t PageDecoder::GetNextPage()
+{
+    if( 0 == mCount )
+        return mCount;
+
+    // the current page, then outwards from it a page at a time,
+    // wrapping around the ends like stepping through them does
+    AnimationFrame page;
+    for( size_t i = 0; i <= PREFETCH_PAGES * 2; ++i )
+    {
+        const size_t offset = ( ( i + 1 ) / 2 ) % mCount;
+        const size_t index = ( i % 2 == 1 ? mCurrent + offset : mCurrent + mCount - offset ) % mCount;
+        if( mTried.count( index ) > 0 || mPages.get( page, index, false ) )
+            continue;
+
+        return index;
+    }
+    return mCount;
+}
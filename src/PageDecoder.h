@@ -0,0 +1,78 @@
+#ifndef PAGEDECODER_H
+#define PAGEDECODER_H
+
+#include <wx/thread.h>
+#include <wx/stream.h>
+
+#include <set>
+#include <vector>
+#include <functional>
+
+#include "wxMultiThreadHelper.h"
+#include "AnimationFrame.h"
+#include "LruCache.h"
+
+
+// decodes the pages of a multi-image file (TIFF, ICO, ...) one at a time
+// as they're asked for, keeping the file itself in memory so pages that
+// got evicted from the budget can be decoded again
+// the worker also decodes the pages on either side of the last one
+// asked for, so stepping through them doesn't wait
+class PageDecoder : public FrameSource, public wxMultiThreadHelper
+{
+public:
+    // reads the rest of stream, which holds count pages
+    // budget is in bytes of decoded pages
+    PageDecoder( wxInputStream& stream, size_t count, size_t budget );
+    ~PageDecoder();
+
+    virtual bool GetFrame( size_t index, AnimationFrame& frame );
+    virtual void SetEventSink( wxEvtHandler* sink, int id );
+    virtual size_t GetBytes();
+    virtual bool KeepsFrames() const { return false; }
+
+private:
+    virtual wxThread::ExitCode Entry();
+
+    // safe to call from any thread, mData never changes
+    AnimationFrame Decode( size_t index ) const;
+
+    // the next page worth decoding, or mCount if none
+    // mMutex must be held
+    size_t GetNextPage();
+
+    // pages on each side of the current one to have ready
+    static const size_t PREFETCH_PAGES = 1;
+
+    std::vector< unsigned char > mData;
+    const size_t mCount;
+
+    struct FrameCost
+    {
+        size_t operator()( const AnimationFrame& frame ) const
+        {
+            return frame.GetBytes();
+        }
+    };
+    LruCache< size_t, AnimationFrame, std::hash< size_t >, FrameCost > mPages;
+
+    // last page asked for
+    size_t mCurrent;
+    // pages decoded since mCurrent last changed, so ones that don't
+    // fit in the budget next to it don't get decoded over and over
+    std::set< size_t > mTried;
+    wxEvtHandler* mSink;
+    int mSinkId;
+    bool mQuit;
+
+    // guards everything from mPages on
+    wxMutex mMutex;
+    // signalled when mCurrent changes or it's time to quit
+    wxCondition mChanged;
+
+    // no copy ctor/assignment operator
+    PageDecoder( const PageDecoder& );
+    PageDecoder& operator=( const PageDecoder& );
+};
+
+#endif
@@ -0,0 +1,457 @@
+#include "Resampler.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+
+inline int Clamp( int val, int minVal, int maxVal )
+{
+    if( val < minVal )  return minVal;
+    if( val > maxVal )  return maxVal;
+    return val;
+}
+
+
+// filter kernels, x is in units of source samples at 1:1
+double FilterBox( double x )
+{
+    return ( x >= -0.5 && x < 0.5 ) ? 1.0 : 0.0;
+}
+
+double FilterTriangle( double x )
+{
+    x = fabs( x );
+    return ( x < 1.0 ) ? 1.0 - x : 0.0;
+}
+
+// Mitchell-Netravali with B = C = 1/3
+double FilterMitchell( double x )
+{
+    const double B = 1.0 / 3.0;
+    const double C = 1.0 / 3.0;
+    x = fabs( x );
+    if( x < 1.0 )
+        return ( ( 12 - 9 * B - 6 * C ) * x * x * x + ( -18 + 12 * B + 6 * C ) * x * x + ( 6 - 2 * B ) ) / 6;
+    if( x < 2.0 )
+        return ( ( -B - 6 * C ) * x * x * x + ( 6 * B + 30 * C ) * x * x + ( -12 * B - 48 * C ) * x + ( 8 * B + 24 * C ) ) / 6;
+    return 0.0;
+}
+
+double Sinc( double x )
+{
+    const double pi = 3.14159265358979323846;
+    if( x == 0.0 )
+        return 1.0;
+    x *= pi;
+    return sin( x ) / x;
+}
+
+double FilterLanczos3( double x )
+{
+    return ( fabs( x ) < 3.0 ) ? Sinc( x ) * Sinc( x / 3.0 ) : 0.0;
+}
+
+struct FilterInfo
+{
+    double (*mKernel)( double );
+    double mRadius;
+};
+
+FilterInfo GetFilterInfo( Filter::Type filter )
+{
+    FilterInfo info;
+    switch( filter )
+    {
+    case Filter::Box:
+        info.mKernel = FilterBox;
+        info.mRadius = 0.5;
+        break;
+    default:
+    case Filter::Triangle:
+        info.mKernel = FilterTriangle;
+        info.mRadius = 1.0;
+        break;
+    case Filter::Mitchell:
+        info.mKernel = FilterMitchell;
+        info.mRadius = 2.0;
+        break;
+    case Filter::Lanczos3:
+        info.mKernel = FilterLanczos3;
+        info.mRadius = 3.0;
+        break;
+    }
+    return info;
+}
+
+double GetFilterRadius( Filter::Type filter )
+{
+    if( Filter::Nearest == filter )
+        return 0.5;
+    return GetFilterInfo( filter ).mRadius;
+}
+
+
+FilterTable::FilterTable( size_t srcSize, size_t dstSize, double scale, Filter::Type filter )
+{
+    const FilterInfo info = GetFilterInfo( filter );
+
+    // when minifying the kernel is stretched to cover every source sample
+    const double filterScale = min( scale, 1.0 );
+    const double radius = info.mRadius / filterScale;
+    const int lastSrc = static_cast< int >( srcSize ) - 1;
+    const int one = 1 << WEIGHT_BITS;
+
+    vector< double > weights;
+    mContribs.resize( dstSize );
+    for( size_t i = 0; i < dstSize; ++i )
+    {
+        const double center = ( i + 0.5 ) / scale - 0.5;
+        const int lo = static_cast< int >( ceil( center - radius ) );
+        const int hi = static_cast< int >( floor( center + radius ) );
+
+        // fold taps that fall off the edges onto the edge samples
+        const int first = Clamp( lo, 0, lastSrc );
+        const int last = Clamp( hi, 0, lastSrc );
+        weights.assign( last - first + 1, 0.0 );
+        double sum = 0.0;
+        for( int j = lo; j <= hi; ++j )
+        {
+            const double w = info.mKernel( ( j - center ) * filterScale );
+            weights[ Clamp( j, 0, lastSrc ) - first ] += w;
+            sum += w;
+        }
+
+        // degenerate (or entirely zero) footprint, fall back to nearest
+        if( fabs( sum ) < 1e-8 )
+        {
+            const int nearest = Clamp( static_cast< int >( floor( center + 0.5 ) ), 0, lastSrc );
+            Contrib& contrib = mContribs[ i ];
+            contrib.mFirst = nearest;
+            contrib.mCount = 1;
+            contrib.mWeights = mWeights.size();
+            mWeights.push_back( static_cast< short >( one ) );
+            continue;
+        }
+
+        // trim zero taps off both ends
+        size_t begin = 0;
+        size_t end = weights.size();
+        while( begin + 1 < end && weights[ begin ] == 0.0 )    begin++;
+        while( end - 1 > begin && weights[ end - 1 ] == 0.0 )  end--;
+
+        Contrib& contrib = mContribs[ i ];
+        contrib.mFirst = first + static_cast< int >( begin );
+        contrib.mCount = static_cast< int >( end - begin );
+        contrib.mWeights = mWeights.size();
+
+        // quantize, dumping the rounding error on the largest tap so
+        // every set of weights sums to exactly 1.0
+        int total = 0;
+        size_t largest = mWeights.size();
+        for( size_t j = begin; j < end; ++j )
+        {
+            const int w = static_cast< int >( floor( weights[ j ] / sum * one + 0.5 ) );
+            total += w;
+            if( mWeights.size() == contrib.mWeights || w > mWeights[ largest ] )
+                largest = mWeights.size();
+            mWeights.push_back( static_cast< short >( w ) );
+        }
+        mWeights[ largest ] = static_cast< short >( mWeights[ largest ] + ( one - total ) );
+    }
+}
+
+
+// intermediate samples are signed so the negative lobes of the sharper
+// filters survive between passes; LINEAR_ONE is 1.0 in linear light
+static const int LINEAR_ONE = 32767;
+
+// 8-bit sRGB <-> 15-bit linear light conversion tables
+struct SrgbTables
+{
+    short mToLinear[ 256 ];
+    unsigned char mFromLinear[ LINEAR_ONE + 1 ];
+
+    SrgbTables()
+    {
+        for( size_t i = 0; i < 256; ++i )
+        {
+            const double s = i / 255.0;
+            const double l = ( s <= 0.04045 ) ? s / 12.92 : pow( ( s + 0.055 ) / 1.055, 2.4 );
+            mToLinear[ i ] = static_cast< short >( floor( l * LINEAR_ONE + 0.5 ) );
+        }
+
+        for( int i = 0; i <= LINEAR_ONE; ++i )
+        {
+            const double l = i / static_cast< double >( LINEAR_ONE );
+            const double s = ( l <= 0.0031308 ) ? l * 12.92 : 1.055 * pow( l, 1.0 / 2.4 ) - 0.055;
+            mFromLinear[ i ] = static_cast< unsigned char >( floor( s * 255.0 + 0.5 ) );
+        }
+    }
+};
+
+// built at startup so workers never race on it
+static const SrgbTables sSrgb;
+
+// without SRGB samples are just rescaled (by 128.5, exactly invertible),
+// which is plain arithmetic the compiler can vectorize instead of a table
+// lookup per sample
+template< bool SRGB >
+inline short ToLinear( unsigned char val )
+{
+    return SRGB ? sSrgb.mToLinear[ val ] : static_cast< short >( ( val * 257 ) >> 1 );
+}
+
+template< bool SRGB >
+inline unsigned char FromLinear( int val )
+{
+    return SRGB ? sSrgb.mFromLinear[ val ] : static_cast< unsigned char >( ( val * 2 + 128 ) / 257 );
+}
+
+
+// drops the fixed-point weight scale off a filtered sum
+inline int Unweight( int acc )
+{
+    return ( acc + ( 1 << ( FilterTable::WEIGHT_BITS - 1 ) ) ) >> FilterTable::WEIGHT_BITS;
+}
+
+// filters one source row horizontally into count linear samples
+template< size_t CH, bool SRGB >
+void HorizontalPass
+    (
+    short* dst,
+    const unsigned char* srcRow,
+    const size_t dstX,
+    const size_t count,
+    const FilterTable& horiz
+    )
+{
+    const short* weights = horiz.GetWeights();
+    const size_t maxX = horiz.GetSize() - 1;
+    for( size_t x = 0; x < count; ++x )
+    {
+        const FilterTable::Contrib& contrib = horiz.Get( min( dstX + x, maxX ) );
+        const short* w = &weights[ contrib.mWeights ];
+        const unsigned char* srcPx = &srcRow[ contrib.mFirst * CH ];
+
+        int acc[ CH ] = { 0 };
+        for( int k = 0; k < contrib.mCount; ++k )
+        {
+            for( size_t c = 0; c < CH; ++c )
+            {
+                acc[ c ] += w[ k ] * ToLinear< SRGB >( srcPx[ k * CH + c ] );
+            }
+        }
+
+        for( size_t c = 0; c < CH; ++c )
+        {
+            dst[ x * CH + c ] = static_cast< short >( Clamp( Unweight( acc[ c ] ), -32768, 32767 ) );
+        }
+    }
+}
+
+// same as HorizontalPass(), but srcRow holds palette indices and
+// linearPalette the already-linearized CH samples of each entry
+template< size_t CH >
+void HorizontalPassIndexed
+    (
+    short* dst,
+    const unsigned char* srcRow,
+    const short* linearPalette,
+    const size_t dstX,
+    const size_t count,
+    const FilterTable& horiz
+    )
+{
+    const short* weights = horiz.GetWeights();
+    const size_t maxX = horiz.GetSize() - 1;
+    for( size_t x = 0; x < count; ++x )
+    {
+        const FilterTable::Contrib& contrib = horiz.Get( min( dstX + x, maxX ) );
+        const short* w = &weights[ contrib.mWeights ];
+        const unsigned char* srcPx = &srcRow[ contrib.mFirst ];
+
+        int acc[ CH ] = { 0 };
+        for( int k = 0; k < contrib.mCount; ++k )
+        {
+            const short* entry = &linearPalette[ srcPx[ k ] * CH ];
+            for( size_t c = 0; c < CH; ++c )
+            {
+                acc[ c ] += w[ k ] * entry[ c ];
+            }
+        }
+
+        for( size_t c = 0; c < CH; ++c )
+        {
+            dst[ x * CH + c ] = static_cast< short >( Clamp( Unweight( acc[ c ] ), -32768, 32767 ) );
+        }
+    }
+}
+
+// if linearPalette is set src holds palette indices, otherwise CH samples per pixel
+template< size_t CH, bool SRGB >
+bool Resample
+    (
+    unsigned char* dst,
+    const size_t dstW,
+    const size_t dstH,
+    const size_t dstX,
+    const size_t dstY,
+    const unsigned char* src,
+    const size_t srcW,
+    const short* linearPalette,
+    const FilterTable& horiz,
+    const FilterTable& vert,
+    ScratchArena& arena,
+    const CancelCheck* cancel
+    )
+{
+    const short* weights = vert.GetWeights();
+    const size_t maxY = vert.GetSize() - 1;
+
+    // source rows the vertical pass will touch
+    int rowFirst = vert.Get( min( dstY, maxY ) ).mFirst;
+    int rowLast = rowFirst;
+    for( size_t y = 0; y < dstH; ++y )
+    {
+        const FilterTable::Contrib& contrib = vert.Get( min( dstY + y, maxY ) );
+        rowFirst = min( rowFirst, contrib.mFirst );
+        rowLast = max( rowLast, contrib.mFirst + contrib.mCount - 1 );
+    }
+
+    const size_t rowStride = dstW * CH;
+    short* rows = arena.Alloc< short >( ( rowLast - rowFirst + 1 ) * rowStride );
+    int* acc = arena.Alloc< int >( rowStride );
+
+    // source rows are filtered horizontally once each, just before the
+    // first destination row that needs them
+    int rowsDone = rowFirst;
+    for( size_t y = 0; y < dstH; ++y )
+    {
+        if( 0 == y % CANCEL_ROWS && NULL != cancel && cancel->IsCancelled() )
+            return false;
+
+        const FilterTable::Contrib& contrib = vert.Get( min( dstY + y, maxY ) );
+        for( ; rowsDone < contrib.mFirst + contrib.mCount; ++rowsDone )
+        {
+            if( NULL != linearPalette )
+            {
+                HorizontalPassIndexed< CH >
+                    (
+                    &rows[ ( rowsDone - rowFirst ) * rowStride ],
+                    &src[ rowsDone * srcW ],
+                    linearPalette,
+                    dstX,
+                    dstW,
+                    horiz
+                    );
+                continue;
+            }
+
+            HorizontalPass< CH, SRGB >
+                (
+                &rows[ ( rowsDone - rowFirst ) * rowStride ],
+                &src[ rowsDone * srcW * CH ],
+                dstX,
+                dstW,
+                horiz
+                );
+        }
+
+        // vertical pass, tap-major so the inner loop runs down a whole row
+        const short* w = &weights[ contrib.mWeights ];
+        fill( acc, acc + rowStride, 0 );
+        for( int k = 0; k < contrib.mCount; ++k )
+        {
+            const short* row = &rows[ ( contrib.mFirst + k - rowFirst ) * rowStride ];
+            const int wk = w[ k ];
+            for( size_t i = 0; i < rowStride; ++i )
+            {
+                acc[ i ] += wk * row[ i ];
+            }
+        }
+
+        unsigned char* dstRow = &dst[ y * rowStride ];
+        for( size_t i = 0; i < rowStride; ++i )
+        {
+            dstRow[ i ] = FromLinear< SRGB >( Clamp( Unweight( acc[ i ] ), 0, LINEAR_ONE ) );
+        }
+    }
+
+    return true;
+}
+
+bool Resample
+    (
+    unsigned char* dst,
+    const size_t dstW,
+    const size_t dstH,
+    const size_t dstX,
+    const size_t dstY,
+    const unsigned char* src,
+    const size_t srcW,
+    const size_t channels,
+    const bool srgb,
+    const FilterTable& horiz,
+    const FilterTable& vert,
+    ScratchArena& arena,
+    const CancelCheck* cancel
+    )
+{
+    if( 3 == channels && srgb )
+        return Resample< 3, true >( dst, dstW, dstH, dstX, dstY, src, srcW, NULL, horiz, vert, arena, cancel );
+    if( 3 == channels )
+        return Resample< 3, false >( dst, dstW, dstH, dstX, dstY, src, srcW, NULL, horiz, vert, arena, cancel );
+    if( 1 == channels && srgb )
+        return Resample< 1, true >( dst, dstW, dstH, dstX, dstY, src, srcW, NULL, horiz, vert, arena, cancel );
+    if( 1 == channels )
+        return Resample< 1, false >( dst, dstW, dstH, dstX, dstY, src, srcW, NULL, horiz, vert, arena, cancel );
+    return true;
+}
+
+template< size_t CH, bool SRGB >
+const short* LinearizePalette( const unsigned char* palette, ScratchArena& arena )
+{
+    // colors are the first 3 bytes of each entry, alpha the last
+    const size_t first = ( 1 == CH ) ? 3 : 0;
+    short* linear = arena.Alloc< short >( 256 * CH );
+    for( size_t i = 0; i < 256; ++i )
+    {
+        for( size_t c = 0; c < CH; ++c )
+        {
+            linear[ i * CH + c ] = ToLinear< SRGB >( palette[ i * 4 + first + c ] );
+        }
+    }
+    return linear;
+}
+
+bool ResampleIndexed
+    (
+    unsigned char* dst,
+    const size_t dstW,
+    const size_t dstH,
+    const size_t dstX,
+    const size_t dstY,
+    const unsigned char* src,
+    const size_t srcW,
+    const unsigned char* palette,
+    const size_t channels,
+    const bool srgb,
+    const FilterTable& horiz,
+    const FilterTable& vert,
+    ScratchArena& arena,
+    const CancelCheck* cancel
+    )
+{
+    // each entry only gets linearized once instead of once per tap
+    if( 3 == channels && srgb )
+        return Resample< 3, true >( dst, dstW, dstH, dstX, dstY, src, srcW, LinearizePalette< 3, true >( palette, arena ), horiz, vert, arena, cancel );
+    if( 3 == channels )
+        return Resample< 3, false >( dst, dstW, dstH, dstX, dstY, src, srcW, LinearizePalette< 3, false >( palette, arena ), horiz, vert, arena, cancel );
+    if( 1 == channels && srgb )
+        return Resample< 1, true >( dst, dstW, dstH, dstX, dstY, src, srcW, LinearizePalette< 1, true >( palette, arena ), horiz, vert, arena, cancel );
+    if( 1 == channels )
+        return Resample< 1, false >( dst, dstW, dstH, dstX, dstY, src, srcW, LinearizePalette< 1, false >( palette, arena ), horiz, vert, arena, cancel );
+    return true;
+}
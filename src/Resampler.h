@@ -0,0 +1,110 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <cstddef>
+#include <vector>
+
+#include "ScratchArena.h"
+
+
+// resampling filters, values match the filter field of ExtRect
+// and are in (roughly) increasing order of quality and cost
+struct Filter
+{
+    enum Type
+    {
+        Nearest = -1,
+        Box,
+        Triangle,
+        Mitchell,
+        Lanczos3,
+    };
+};
+
+// support radius of filter, in source samples at 1:1
+double GetFilterRadius( Filter::Type filter );
+
+
+// precomputed contributors for every destination sample along one axis
+// of a scaled image; weights are 2.14 fixed-point and sum to 1.0
+class FilterTable
+{
+public:
+    static const int WEIGHT_BITS = 14;
+
+    FilterTable( size_t srcSize, size_t dstSize, double scale, Filter::Type filter );
+
+    struct Contrib
+    {
+        int mFirst;         // first source sample
+        int mCount;         // number of source samples
+        size_t mWeights;    // offset into GetWeights()
+    };
+
+    size_t GetSize() const                  { return mContribs.size(); }
+    const Contrib& Get( size_t i ) const    { return mContribs[ i ]; }
+    const short* GetWeights() const         { return &mWeights[ 0 ]; }
+
+private:
+    std::vector< Contrib > mContribs;
+    std::vector< short > mWeights;
+};
+
+
+// polled by long-running operations every so often, which give up
+// as soon as it returns true
+class CancelCheck
+{
+public:
+    virtual ~CancelCheck() { }
+    virtual bool IsCancelled() const = 0;
+};
+
+// destination rows between cancellation checks
+static const size_t CANCEL_ROWS = 16;
+
+// resamples the dstW x dstH window at (dstX, dstY) of the scaled image
+// described by horiz/vert out of src into dst, both tightly packed with
+// the given number of interleaved 8-bit channels
+// if srgb is set samples are filtered in linear light, otherwise they're
+// filtered as-is: gamma-naive, but cheaper and fine for previews and alpha
+// returns false if cancel (which may be NULL) cut it short
+bool Resample
+    (
+    unsigned char* dst,
+    const size_t dstW,
+    const size_t dstH,
+    const size_t dstX,
+    const size_t dstY,
+    const unsigned char* src,
+    const size_t srcW,
+    const size_t channels,
+    const bool srgb,
+    const FilterTable& horiz,
+    const FilterTable& vert,
+    ScratchArena& arena,
+    const CancelCheck* cancel = NULL
+    );
+
+// same as Resample(), but src holds one 8-bit index per pixel into
+// palette, 256 RGBA entries that are looked up as the rows are read
+// channels picks what gets resampled: 3 for the colors, 1 for the alpha
+bool ResampleIndexed
+    (
+    unsigned char* dst,
+    const size_t dstW,
+    const size_t dstH,
+    const size_t dstX,
+    const size_t dstY,
+    const unsigned char* src,
+    const size_t srcW,
+    const unsigned char* palette,
+    const size_t channels,
+    const bool srgb,
+    const FilterTable& horiz,
+    const FilterTable& vert,
+    ScratchArena& arena,
+    const CancelCheck* cancel = NULL
+    );
+
+#endif
@@ -1,11 +1,23 @@
 #include "ScaledImageFactory.h"
+#include "TileKernels.h"
+#include "ScratchArena.h"
+#include "Resampler.h"
 
 #include <wx/mstream.h>
 
-#include <memory>
+#ifdef __WXMSW__
+    #include <wx/msw/wrapwin.h>
+#elif defined( __linux__ )
+    #include <pthread.h>
+    #include <sched.h>
+#endif
 
-#define STB_IMAGE_RESIZE_IMPLEMENTATION
-#include <stb/stb_image_resize.h>
+#include <memory>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
 
 using namespace std;
 
@@ -25,255 +37,571 @@ const unsigned char background_png[] =
 };
 
 
-// blends a foreground RGB triplet (fg) onto a background RGB triplet (bg)
-// using the given alpha value; returns the blended result
-// http://stackoverflow.com/questions/12011081/alpha-blending-2-rgba-colors-in-c/12016968#12016968
-inline void BlendRgb
-    (
-    unsigned char* dst,
-    const unsigned char* fg,
-    const unsigned char* bg,
-    const unsigned char alpha
-    )
-{
-    const unsigned int intAlpha = alpha + 1;
-    const unsigned int invAlpha = 256 - alpha;
-    for( size_t i = 0; i < 3; ++i )
-    {
-        dst[i] = ( ( intAlpha * fg[i] + invAlpha * bg[i] ) >> 8 );
-    }
+// returns the row of the repeating pattern bg that lines up with row y
+// bg dimensions must be powers-of-two
+inline const unsigned char* PatternRow( const wxImage& bg, const size_t y )
+{
+    const size_t bgW = static_cast< size_t >( bg.GetWidth() );
+    const size_t bgH = static_cast< size_t >( bg.GetHeight() );
+    return &bg.GetData()[ ( y & ( bgH - 1 ) ) * bgW * 3 ];
 }
 
 
-// blends fg onto a repeating pattern of bg into dst
-// bg dimensions must be powers-of-two
-void BlendPattern
-    (
-    wxImage& dst,
-    const wxImage& fg,
-    const wxImage& bg
-    )
-{
-    const size_t fgW = static_cast< size_t >( fg.GetWidth() );
+// fills dst with a repeating pattern of bg, starting at row patternY of it
+void FillPattern( wxImage& dst, const wxImage& bg, const size_t patternY )
+{
     const size_t dstW = static_cast< size_t >( dst.GetWidth() );
     const size_t dstH = static_cast< size_t >( dst.GetHeight() );
-
     const size_t bgW = static_cast< size_t >( bg.GetWidth() );
-    const size_t bgH = static_cast< size_t >( bg.GetHeight() );
-
-    const unsigned char* fgData = fg.GetData();
-    const unsigned char* fgAlpha = fg.GetAlpha();
-    unsigned char* bgData = bg.GetData();
-    unsigned char* dstData = dst.GetData();
 
     for( size_t y = 0; y < dstH; ++y )
     {
-        unsigned char* dstPx = &dstData[ y * dstW * 3 ];
-
-        const unsigned char* fgPx = &fgData[ y * fgW * 3 ];
-        const unsigned char* fgAlphaPx = &fgAlpha[ y * fgW ];
-
-        const size_t bgY = ( y & ( bgH-1 ) ) * bgW * 3;
-        const unsigned char* bgRow = &bgData[ bgY ];
-
-        for( size_t x = 0; x < dstW; ++x )
+        unsigned char* dstRow = &dst.GetData()[ y * dstW * 3 ];
+        const unsigned char* bgRow = PatternRow( bg, patternY + y );
+        for( size_t x = 0; x < dstW; x += bgW )
         {
-            const size_t bgX = ( x & ( bgW-1 ) ) * 3;
-            const unsigned char* bgPx = &bgRow[ bgX ];
-
-            BlendRgb( dstPx, fgPx, bgPx, *fgAlphaPx );
-
-            dstPx += 3;
-            fgPx += 3;
-            fgAlphaPx += 1;
+            memcpy( &dstRow[ x * 3 ], bgRow, min( bgW, dstW - x ) * 3 );
         }
     }
 }
 
 
-void GetScaledSubrect( wxImage& dst, const wxImage& src, const double scale, const wxPoint& pos, const int filter )
+// pixels to scale from: a plain image, or an indexed one whose
+// colors get looked up as it's read
+struct Source
+{
+    Source( const wxImage& image )
+        : mW( image.GetWidth() ), mH( image.GetHeight() )
+        , mData( image.GetData() ), mAlpha( image.HasAlpha() ? image.GetAlpha() : NULL )
+        , mPalette( NULL ), mHasAlpha( image.HasAlpha() )
+    { }
+
+    Source( const IndexedImage& image )
+        : mW( image.GetWidth() ), mH( image.GetHeight() )
+        , mData( image.GetIndices() ), mAlpha( NULL )
+        , mPalette( image.GetPalette() ), mHasAlpha( image.HasAlpha() )
+    { }
+
+    size_t mW;
+    size_t mH;
+    const unsigned char* mData;     // RGB, or indices if mPalette is set
+    const unsigned char* mAlpha;    // only for plain images
+    const unsigned char* mPalette;
+    bool mHasAlpha;
+};
+
+
+// scales the subrect of src at pos into dst; if bg is given the result
+// is composited onto a repeating pattern of it using src's alpha,
+// otherwise alpha is ignored; dst's first row lines up with row patternY
+// of the pattern
+// filtered scaling uses the shared filter tables, in linear light if srgb is set
+// all scratch memory comes from arena
+// returns false if cancel (which may be NULL) cut it short
+bool GetScaledSubrect( wxImage& dst, const Source& src, const double scale, const wxPoint& pos, const int filter, const bool srgb, const wxImage* bg, const size_t patternY, const FilterTables& tables, ScratchArena& arena, const CancelCheck* cancel )
 {
-    if( filter == -1 )
+    const size_t srcW = src.mW;
+    const size_t srcH = src.mH;
+    const size_t dstW = static_cast< size_t >( dst.GetWidth() );
+    const size_t dstH = static_cast< size_t >( dst.GetHeight() );
+    const size_t bgW = NULL != bg ? static_cast< size_t >( bg->GetWidth() ) : 0;
+
+    unsigned char* dstData = dst.GetData();
+
+    if( filter == Filter::Nearest )
     {
-        const size_t srcW = static_cast< size_t >( src.GetWidth() );
-        const size_t dstW = static_cast< size_t >( dst.GetWidth() );
-        const size_t dstH = static_cast< size_t >( dst.GetHeight() );
+        // source column/row for every destination column/row, computed once per tile
+        unsigned int* cols = arena.Alloc< unsigned int >( dstW );
+        unsigned int* rows = arena.Alloc< unsigned int >( dstH );
+        BuildNearestTable( cols, pos.x, dstW, scale, srcW );
+        BuildNearestTable( rows, pos.y, dstH, scale, srcH );
+
+        const unsigned char* srcData = src.mData;
+        const bool blend = ( NULL != bg && src.mHasAlpha );
 
-        const float scaleInv = 1.0f / scale;
+        unsigned char* alphaRow = arena.Alloc< unsigned char >( dstW );
+        unsigned char* indexRow = ( NULL != src.mPalette ) ? arena.Alloc< unsigned char >( dstW ) : NULL;
 
-        // color
+        // gather color and alpha and blend in the same pass while the row is still hot
+        for( size_t dstY = 0; dstY < dstH; ++dstY )
         {
-            const unsigned char* srcData = src.GetData();
-            unsigned char* dstData = dst.GetData();
+            if( 0 == dstY % CANCEL_ROWS && NULL != cancel && cancel->IsCancelled() )
+                return false;
 
-            for( size_t dstY = 0; dstY < dstH; ++dstY )
+            const size_t srcY = rows[ dstY ];
+            unsigned char* dstRow = &dstData[ dstY * dstW * 3 ];
+            if( NULL != indexRow )
+            {
+                // gather the indices, then look them up
+                NearestRow( indexRow, &srcData[ srcY * srcW ], cols, dstW, srcW, 1 );
+                PaletteRow( dstRow, indexRow, src.mPalette, dstW, 3 );
+            }
+            else
             {
-                unsigned char* dstRow = &dstData[ dstY * dstW * 3 ];
-    
-                const size_t srcY( ( dstY + pos.y ) * scaleInv );
-                const unsigned char* srcRow = &srcData[ srcY * srcW * 3 ];
-
-                for( size_t dstX = 0; dstX < dstW; ++dstX )
-                {
-                    const size_t srcX( ( dstX + pos.x ) * scaleInv );
-                    const unsigned char* srcPx = &srcRow[ srcX * 3 ];
-                    dstRow[ dstX * 3 + 0 ] = srcPx[ 0 ];
-                    dstRow[ dstX * 3 + 1 ] = srcPx[ 1 ];
-                    dstRow[ dstX * 3 + 2 ] = srcPx[ 2 ];
-                }
+                NearestRow( dstRow, &srcData[ srcY * srcW * 3 ], cols, dstW, srcW, 3 );
             }
+
+            if( !blend )
+                continue;
+
+            if( NULL != indexRow )
+                PaletteRow( alphaRow, indexRow, src.mPalette, dstW, 1 );
+            else
+                NearestRow( alphaRow, &src.mAlpha[ srcY * srcW ], cols, dstW, srcW, 1 );
+            BlendRow( dstRow, dstRow, alphaRow, PatternRow( *bg, patternY + dstY ), bgW, dstW );
         }
+    }
+    else
+    {
+        const bool finished = ( NULL != src.mPalette )
+            ? ResampleIndexed
+                (
+                dstData, dstW, dstH, pos.x, pos.y,
+                src.mData, srcW, src.mPalette, 3, srgb,
+                *tables.mHoriz, *tables.mVert,
+                arena,
+                cancel
+                )
+            : Resample
+                (
+                dstData, dstW, dstH, pos.x, pos.y,
+                src.mData, srcW, 3, srgb,
+                *tables.mHoriz, *tables.mVert,
+                arena,
+                cancel
+                );
+        if( !finished )
+            return false;
 
-        if( !src.HasAlpha() )
-            return;
+        if( NULL == bg || !src.mHasAlpha )
+            return true;
+
+        unsigned char* alpha = arena.Alloc< unsigned char >( dstW * dstH );
+        const bool finishedAlpha = ( NULL != src.mPalette )
+            ? ResampleIndexed
+                (
+                alpha, dstW, dstH, pos.x, pos.y,
+                src.mData, srcW, src.mPalette, 1, false,
+                *tables.mHoriz, *tables.mVert,
+                arena,
+                cancel
+                )
+            : Resample
+                (
+                alpha, dstW, dstH, pos.x, pos.y,
+                src.mAlpha, srcW, 1, false,
+                *tables.mHoriz, *tables.mVert,
+                arena,
+                cancel
+                );
+        if( !finishedAlpha )
+            return false;
 
-        // alpha
+        // composite in place
+        for( size_t dstY = 0; dstY < dstH; ++dstY )
         {
-            const unsigned char* srcData = src.GetAlpha();
-            unsigned char* dstData = dst.GetAlpha();
-
-            for( size_t dstY = 0; dstY < dstH; ++dstY )
-            {
-                unsigned char* dstRow = &dstData[ dstY * dstW ];
-    
-                const size_t srcY( ( dstY + pos.y ) * scaleInv );
-                const unsigned char* srcRow = &srcData[ srcY * srcW ];
-
-                for( size_t dstX = 0; dstX < dstW; ++dstX )
-                {
-                    const size_t srcX( ( dstX + pos.x ) * scaleInv );
-                    const unsigned char* srcPx = &srcRow[ srcX ];
-                    dstRow[ dstX + 0 ] = srcPx[ 0 ];
-                }
-            }
+            unsigned char* dstRow = &dstData[ dstY * dstW * 3 ];
+            BlendRow( dstRow, dstRow, &alpha[ dstY * dstW ], PatternRow( *bg, patternY + dstY ), bgW, dstW );
         }
     }
-    else
+
+    return true;
+}
+
+FilterTables FilterCache::Get( const wxSize& srcSize, double scale, Filter::Type filter )
+{
+    const size_t srcW = static_cast< size_t >( srcSize.GetWidth() );
+    const size_t srcH = static_cast< size_t >( srcSize.GetHeight() );
+
+    wxMutexLocker locker( mMutex );
+    FilterTables& tables = mTables[ Key( srcW, srcH, scale, filter ) ];
+    if( NULL == tables.mHoriz )
     {
-        const stbir_filter filter = STBIR_FILTER_TRIANGLE;
-        const stbir_edge edge = STBIR_EDGE_CLAMP;
-        const stbir_colorspace colorspace = STBIR_COLORSPACE_SRGB;
+        // cover the whole scaled image, tiles index in by their position
+        const size_t dstW = static_cast< size_t >( ceil( srcW * scale ) );
+        const size_t dstH = static_cast< size_t >( ceil( srcH * scale ) );
+        tables.mHoriz.reset( new FilterTable( srcW, dstW, scale, filter ) );
+        tables.mVert.reset( new FilterTable( srcH, dstH, scale, filter ) );
+    }
+    return tables;
+}
+
+// returns a pooled tile's pixels to the pool once the last reference goes away
+struct PooledImageDeleter
+{
+    PooledImageDeleter( const wxSharedPtr< BufferPool >& pool, unsigned char* data, size_t capacity )
+        : mPool( pool ), mData( data ), mCapacity( capacity )
+    { }
 
-        stbir_resize_subpixel
+    void operator()( wxImage* image )
+    {
+        delete image;
+        mPool->Release( mData, mCapacity );
+    }
+
+    wxSharedPtr< BufferPool > mPool;
+    unsigned char* mData;
+    size_t mCapacity;
+};
+
+// copies the part of src at pos into dst, both RGB-only
+void CopySubrect( wxImage& dst, const wxImage& src, const wxPoint& pos )
+{
+    const size_t srcW = static_cast< size_t >( src.GetWidth() );
+    const size_t dstW = static_cast< size_t >( dst.GetWidth() );
+    const size_t dstH = static_cast< size_t >( dst.GetHeight() );
+    for( size_t y = 0; y < dstH; ++y )
+    {
+        memcpy
             (
-            src.GetData(), src.GetWidth(), src.GetHeight(), 0,
-            dst.GetData(), dst.GetWidth(), dst.GetHeight(), 0,
-            STBIR_TYPE_UINT8,
-            3,
-            0,
-            STBIR_ALPHA_CHANNEL_NONE,
-            edge, edge,
-            filter, filter,
-            colorspace,
-            NULL,
-            scale, scale,
-            static_cast< float >( pos.x ), static_cast< float >( pos.y )
+            &dst.GetData()[ y * dstW * 3 ],
+            &src.GetData()[ ( ( pos.y + y ) * srcW + pos.x ) * 3 ],
+            dstW * 3
             );
+    }
+}
+
+ScaledImageFactory::wxImagePtr ScaledImageFactory::NewTile( const wxSize& size )
+{
+    const size_t tileBytes = static_cast< size_t >( size.GetWidth() ) * size.GetHeight() * 3;
+    size_t capacity = 0;
+    unsigned char* data = mTilePool->Acquire( tileBytes, capacity );
+    return wxImagePtr
+        (
+        new wxImage( size, data, true ),
+        PooledImageDeleter( mTilePool, data, capacity )
+        );
+}
+
+// cancels once the factory has moved on to a newer generation
+class GenerationCheck : public CancelCheck
+{
+public:
+    GenerationCheck( const std::atomic< unsigned int >& live, unsigned int generation )
+        : mLive( live ), mGeneration( generation )
+    { }
+
+    virtual bool IsCancelled() const
+    {
+        return mLive.load( std::memory_order_relaxed ) != mGeneration;
+    }
+
+private:
+    const std::atomic< unsigned int >& mLive;
+    const unsigned int mGeneration;
+};
 
-        if( !src.HasAlpha() )
-            return;
+bool ScaledImageFactory::Render( wxImage& dst, const ExtRect& rect, const Context& ctx, const size_t patternY, ScratchArena& arena )
+{
+    // sample from the smallest mip level that still has at least
+    // as much resolution as the destination
+    const size_t level = ctx.mMipMap->GetLevelForScale( ctx.mScale );
+    const wxImagePtr src = ctx.mMipMap->GetLevel( level );
+    const wxSize srcSize = ctx.mMipMap->GetLevelSize( level );
+    const double levelScale = ctx.mScale * ( 1 << level );
+
+    // figure out which part of the level this rect reads from,
+    // padded out by the filter footprint
+    const wxRect& dstRect = get<2>( rect );
+    const Filter::Type filter = static_cast< Filter::Type >( get<1>( rect ) );
+    const int support = static_cast< int >( ceil( GetFilterRadius( filter ) / min( levelScale, 1.0 ) ) ) + 1;
+    const wxRect srcRect
+        (
+        wxPoint
+            (
+            static_cast< int >( floor( dstRect.GetLeft() / levelScale ) ),
+            static_cast< int >( floor( dstRect.GetTop() / levelScale ) )
+            ),
+        wxPoint
+            (
+            static_cast< int >( ceil( ( dstRect.GetRight() + 1 ) / levelScale ) ),
+            static_cast< int >( ceil( ( dstRect.GetBottom() + 1 ) / levelScale ) )
+            )
+        );
+    const Alpha::Type alpha = ctx.mMipMap->GetAlphaType( level, wxRect( srcRect ).Inflate( support ) );
+
+    if( Alpha::Transparent == alpha )
+    {
+        // nothing to see here but the background
+        FillPattern( dst, mStipple, patternY );
+        return true;
+    }
+
+    FilterTables tables;
+    if( filter != Filter::Nearest )
+        tables = ctx.mFilters->Get( srcSize, levelScale, filter );
+
+    // preview filters can skip the trip through linear light
+    const bool srgb = !( ctx.mNaivePreviews && filter < Filter::Mitchell );
+
+    const GenerationCheck cancel( ctx.mSpeculative ? mLiveSpeculation : mLiveGeneration, ctx.mGeneration );
+
+    // only blend when some of the rect is actually see-through
+    const wxImage* stipple = ( Alpha::Mixed == alpha ? &mStipple : NULL );
+
+    // the base of an indexed frame gets its colors looked up as it's read
+    return GetScaledSubrect
+        (
+        dst,
+        NULL != src ? Source( *src ) : Source( *ctx.mMipMap->GetIndexedBase() ),
+        levelScale,
+        dstRect.GetPosition(),
+        filter,
+        srgb,
+        stipple,
+        patternY,
+        tables,
+        arena,
+        &cancel
+        );
+}
 
-        stbir_resize_subpixel
+wxRect ScaledImageFactory::GetSourceRect( const ExtRect& rect, double scale )
+{
+    // Render() samples from a mip level with a scale in (0.5, 1] when
+    // minifying, so its filter reaches at most twice the radius plus
+    // a bit of rounding, and each level pixel covers up to 1 / scale
+    // full-size pixels
+    const Filter::Type filter = static_cast< Filter::Type >( get<1>( rect ) );
+    const double reach = ( 2.0 * GetFilterRadius( filter ) + 3.0 ) / min( scale, 1.0 );
+    const int margin = static_cast< int >( ceil( reach ) );
+
+    const wxRect& dstRect = get<2>( rect );
+    return wxRect
+        (
+        wxPoint
             (
-            src.GetAlpha(), src.GetWidth(), src.GetHeight(), 0,
-            dst.GetAlpha(), dst.GetWidth(), dst.GetHeight(), 0,
-            STBIR_TYPE_UINT8,
-            1,
-            0,
-            STBIR_FLAG_ALPHA_PREMULTIPLIED,
-            edge, edge,
-            filter, filter,
-            colorspace,
-            NULL,
-            scale, scale,
-            static_cast< float >( pos.x ), static_cast< float >( pos.y )
-            );
+            static_cast< int >( floor( dstRect.GetLeft() / scale ) ) - margin,
+            static_cast< int >( floor( dstRect.GetTop() / scale ) ) - margin
+            ),
+        wxPoint
+            (
+            static_cast< int >( ceil( ( dstRect.GetRight() + 1 ) / scale ) ) + margin,
+            static_cast< int >( ceil( ( dstRect.GetBottom() + 1 ) / scale ) ) + margin
+            )
+        );
+}
+
+size_t ScaledImageFactory::GetStripCount( const ExtRect& rect, const Context& ctx )
+{
+    const size_t numThreads = GetWorkerCount();
+    if( numThreads <= 1 )
+        return 1;
+
+    // only worth it if there isn't already enough work to go around
+    const size_t pending = mJobPool.GetCount();
+    if( pending + 1 >= numThreads )
+        return 1;
+
+    // rough multiply-add count: a horizontal pass over every source row
+    // the rect touches plus a vertical pass over every destination sample
+    const size_t level = ctx.mMipMap->GetLevelForScale( ctx.mScale );
+    const double levelScale = ctx.mScale * ( 1 << level );
+    const wxRect& dstRect = get<2>( rect );
+    const Filter::Type filter = static_cast< Filter::Type >( get<1>( rect ) );
+    const double taps = ( Filter::Nearest == filter ) ? 1.0 : 2.0 * GetFilterRadius( filter ) / min( levelScale, 1.0 );
+    const double srcRows = dstRect.GetHeight() / levelScale + taps;
+    const double cost = ( srcRows + dstRect.GetHeight() ) * dstRect.GetWidth() * taps;
+
+    size_t strips = static_cast< size_t >( cost / STRIP_COST );
+    strips = min( strips, numThreads - pending );
+    strips = min( strips, static_cast< size_t >( dstRect.GetHeight() ) / MIN_STRIP_ROWS );
+    return max( strips, static_cast< size_t >( 1 ) );
+}
+
+void ScaledImageFactory::Deliver( const ExtRect& rect, const vector< wxRect >& tiles, const Context& ctx, const wxImagePtr& image )
+{
+    const wxRect& area = get<2>( rect );
+    for( const wxRect& tile : tiles )
+    {
+        ResultItem result;
+        result.mGeneration = ctx.mGeneration;
+        result.mSpeculative = ctx.mSpeculative;
+        result.mScale = ctx.mScale;
+        result.mRect = ExtRect( get<0>( rect ), get<1>( rect ), tile );
+        if( 1 == tiles.size() )
+        {
+            result.mImage = image;
+        }
+        else if( NULL != image )
+        {
+            // carve the tile out of the band
+            result.mImage = NewTile( tile.GetSize() );
+            CopySubrect( *result.mImage, *image, tile.GetPosition() - area.GetPosition() );
+        }
+
+        // the GUI thread is way behind, give it a moment, unless nobody
+        // wants these anymore; it might be waiting on us to exit
+        bool pushed = false;
+        while( !( pushed = mResults.TryPush( result ) ) && !IsStale( ctx ) )
+            wxThread::Sleep( 1 );
+        if( !pushed )
+            break;
     }
+
+    // only one event in flight at a time; the GUI thread clears the flag
+    // before draining, so anything posted after that raises a new one
+    if( !mNotifyPending.exchange( true ) )
+        wxQueueEvent( mEventSink, new wxThreadEvent( wxEVT_THREAD, mEventId ) );
 }
 
 // threadland
+// restricts the calling thread to the CPUs set in mask
+// a no-op if mask is 0 or the platform can't do it
+void SetThreadAffinity( const unsigned long long mask )
+{
+    if( 0 == mask )
+        return;
+
+#ifdef __WXMSW__
+    SetThreadAffinityMask( GetCurrentThread(), static_cast< DWORD_PTR >( mask ) );
+#elif defined( __linux__ )
+    cpu_set_t cpus;
+    CPU_ZERO( &cpus );
+    for( size_t i = 0; i < 64 && i < CPU_SETSIZE; ++i )
+    {
+        if( mask & ( 1ULL << i ) )
+            CPU_SET( i, &cpus );
+    }
+    pthread_setaffinity_np( pthread_self(), sizeof( cpus ), &cpus );
+#endif
+}
+
 wxThread::ExitCode ScaledImageFactory::Entry()
 {
+    // this worker's scratch memory, recycled between jobs
+    ScratchArena arena;
+
+    const size_t worker = mJobPool.AttachWorker();
+    SetThreadAffinity( mWorkerOptions.mAffinity );
+
     JobItem job;
-    while( wxSORTABLEMSGQUEUE_NO_ERROR == mJobPool.Receive( job ) )
+    while( true )
     {
-        if( NULL == job.second.mImage || wxThread::This()->TestDestroy() )
+        mJobPool.Receive( worker, job );
+        if( NULL == job.mCtx.mMipMap || wxThread::This()->TestDestroy() )
             break;
 
-        const ExtRect& rect = job.first;
-        Context& ctx = job.second;
+        const ExtRect& rect = job.mRect;
+        const Context& ctx = job.mCtx;
+        const wxRect& area = get<2>( rect );
 
-        ResultItem result;
-        result.mGeneration = ctx.mGeneration;
-        result.mRect = rect;
+        // went stale while it was queued; nobody's waiting on the rest
+        // of a stale split job either, so its strips can just be dropped
+        if( IsStale( ctx ) )
+        {
+            CountJob( mCounters.mJobsCancelled, mCounters.mPixelsCancelled, area );
+            continue;
+        }
 
-        // skip this rect if it isn't currently visible
+        if( NULL != job.mAssembly )
         {
-            wxCriticalSectionLocker locker( mVisibleCs );
-            if( !mVisible.Intersects( get<2>( rect ) ) )
+            // one strip of a split job, rendered straight into its rows
+            // of the shared image; whoever finishes last delivers it
+            Assembly& assembly = *job.mAssembly;
+            const wxRect& whole = get<2>( assembly.mRect );
+            const size_t row = static_cast< size_t >( area.GetTop() - whole.GetTop() );
+            wxImage dst( area.GetSize(), &assembly.mImage->GetData()[ row * whole.GetWidth() * 3 ], true );
+            const bool finished = Render( dst, rect, ctx, row, arena );
+            arena.Reset();
+            if( !finished )
             {
-                mResultQueue.Post( result );
+                CountJob( mCounters.mJobsCancelled, mCounters.mPixelsCancelled, area );
                 continue;
             }
+
+            CountJob( mCounters.mJobsRendered, mCounters.mPixelsRendered, area );
+            if( 0 == wxAtomicDec( assembly.mRemaining ) )
+                Deliver( assembly.mRect, assembly.mTiles, ctx, assembly.mImage );
+            continue;
         }
 
-        wxImagePtr temp( new wxImage( get<2>( rect ).GetSize(), false ) );
-        if( ctx.mImage->HasAlpha() )
+        // a plain job is a single tile
+        if( job.mTiles.empty() )
+            job.mTiles.push_back( get<2>( rect ) );
+
+        // skip this job if none of it is currently visible
+        bool visible = true;
+        if( !job.mPrefetch && !ctx.mSpeculative )
         {
-            temp->SetAlpha( NULL );
+            wxCriticalSectionLocker locker( mVisibleCs );
+            visible = mVisible.Intersects( get<2>( rect ) );
+        }
+        if( !visible )
+        {
+            mCounters.mJobsSkipped++;
+            Deliver( rect, job.mTiles, ctx, wxImagePtr() );
+            continue;
         }
 
-        GetScaledSubrect
-            (
-            *temp,
-            *ctx.mImage,
-            ctx.mScale,
-            get<2>( rect ).GetPosition(),
-            get<1>( rect )
-            );
+        // bands get rendered whole and carved up into tiles on delivery
+        const wxImagePtr image = NewTile( area.GetSize() );
 
-        if( ctx.mImage->HasAlpha() )
+        const size_t strips = GetStripCount( rect, ctx );
+        if( strips > 1 )
         {
-            result.mImage = new wxImage( get<2>( rect ).GetSize(), false );
-            BlendPattern( *result.mImage, *temp, mStipple );
+            // too much for one worker while others sit idle, so hand out
+            // horizontal strips to render in parallel, ahead of everything else
+            wxSharedPtr< Assembly > assembly( new Assembly );
+            assembly->mRect = rect;
+            assembly->mTiles = job.mTiles;
+            assembly->mImage = image;
+            assembly->mRemaining = static_cast< wxAtomicInt >( strips );
+
+            for( size_t i = strips; i > 0; --i )
+            {
+                const int top = static_cast< int >( area.GetHeight() * ( i - 1 ) / strips );
+                const int bottom = static_cast< int >( area.GetHeight() * i / strips );
+                JobItem stripJob
+                    (
+                    ExtRect
+                        (
+                        get<0>( rect ),
+                        get<1>( rect ),
+                        wxRect( area.GetLeft(), area.GetTop() + top, area.GetWidth(), bottom - top )
+                        ),
+                    ctx
+                    );
+                stripJob.mAssembly = assembly;
+                mJobPool.PostFront( stripJob );
+            }
+            continue;
         }
-        else
+
+        const bool finished = Render( *image, rect, ctx, 0, arena );
+        arena.Reset();
+        if( !finished )
         {
-            result.mImage = temp;
+            CountJob( mCounters.mJobsCancelled, mCounters.mPixelsCancelled, area );
+            continue;
         }
 
-        mResultQueue.Post( result );
-
-        wxQueueEvent( mEventSink, new wxThreadEvent( wxEVT_THREAD, mEventId ) );
+        CountJob( mCounters.mJobsRendered, mCounters.mPixelsRendered, area );
+        Deliver( rect, job.mTiles, ctx, image );
     }
 
     return static_cast< wxThread::ExitCode >( 0 );
 }
 
-ScaledImageFactory::ScaledImageFactory( wxEvtHandler* eventSink, int id )
-    : mEventSink( eventSink ), mEventId( id )
+ScaledImageFactory::ScaledImageFactory( wxEvtHandler* eventSink, int id, const WorkerOptions& options )
+    : mMipMaps( MIPMAP_CACHE_BYTES )
+    , mTilePool( new BufferPool( 64 ) )
+    , mResults( RESULT_RING_SIZE )
+    , mEventSink( eventSink ), mEventId( id )
 {
-    size_t numThreads = wxThread::GetCPUCount();
-    if( numThreads <= 0 )   numThreads = 1;
-    if( numThreads > 1 )    numThreads--;
-
-    for( size_t i = 0; i < numThreads; ++i )
-    {
-        CreateThread();
-    }
-
-    for( wxThread*& thread : GetThreads() )
-    {
-        if( NULL == thread )
-            continue;
-
-        if( thread->Run() != wxTHREAD_NO_ERROR )
-        {
-            delete thread;
-            thread = NULL;
-        }
-    }
-    
+    mLiveGeneration = 0;
+    mLiveSpeculation = 0;
+    mNotifyPending = false;
+    mCounters.mJobsRendered = 0;
+    mCounters.mJobsCancelled = 0;
+    mCounters.mJobsSkipped = 0;
+    mCounters.mPixelsRendered = 0;
+    mCounters.mPixelsCancelled = 0;
+
+    StartWorkers( options );
+
+    mCurrentCtx.mNaivePreviews = false;
+    mCurrentCtx.mSpeculative = false;
     Reset();
 
     wxMemoryInputStream memStream( background_png, sizeof( background_png ) );
@@ -282,82 +610,285 @@ ScaledImageFactory::ScaledImageFactory( wxEvtHandler* eventSink, int id )
 
 ScaledImageFactory::~ScaledImageFactory()
 {
-    // clear job queue and send down "kill" jobs
-    mJobPool.Clear();
-    for( size_t i = 0; i < GetThreads().size(); ++i )
+    StopWorkers();
+}
+
+void ScaledImageFactory::StartWorkers( const WorkerOptions& options )
+{
+    mWorkerOptions = options;
+
+    size_t numThreads = options.mCount;
+    if( 0 == numThreads )
     {
-        mJobPool.Post( JobItem( ExtRect(), Context() ) );
+        const int cpus = wxThread::GetCPUCount();
+        numThreads = ( cpus > 1 ) ? cpus - 1 : 1;
     }
 
+    mJobPool.Resize( numThreads );
+    StartThreads( numThreads, options.mPriority );
+}
+
+void ScaledImageFactory::StopWorkers()
+{
+    // nothing drains mResults while we wait below, so workers stuck on
+    // a full ring have to be able to tell their results are stale
+    NewGeneration();
+
+    // send down "kill" jobs, which go ahead of everything else
     for( wxThread* thread : GetThreads() )
     {
-        if( NULL == thread )
-            continue;
-
-        thread->Wait();
+        if( NULL != thread )
+            mJobPool.PostFront( JobItem() );
     }
+
+    JoinThreads();
+}
+
+void ScaledImageFactory::SetWorkerOptions( const WorkerOptions& options )
+{
+    StopWorkers();
+    StartWorkers( options );
 }
 
-void ScaledImageFactory::SetImage( wxImagePtr& newImage )
+void ScaledImageFactory::SetImage( const AnimationFrame& frame )
 {
-    if( NULL == newImage )
+    if( NULL == frame.GetPixels() )
         throw std::runtime_error( "Image not set!" );
 
-    mCurrentCtx.mImage = newImage;
-    mJobPool.Clear();
+    // queued jobs for the old image are still good, their
+    // results are keyed by frame; RemoveRects() gets rid of the
+    // ones that aren't
+    mCurrentCtx.mMipMap = GetMipMap( frame );
+}
+
+MipMapPtr ScaledImageFactory::GetMipMap( const AnimationFrame& frame )
+{
+    MipMapPtr mipMap;
+    if( mMipMaps.get( mipMap, frame.GetPixels() ) )
+        return mipMap;
+
+    mipMap.reset( new MipMap( frame ) );
+    mMipMaps.insert( frame.GetPixels(), mipMap );
+    return mipMap;
 }
 
 void ScaledImageFactory::SetScale( double newScale )
 {
-    if( NULL == mCurrentCtx.mImage )
+    if( NULL == mCurrentCtx.mMipMap )
         throw std::runtime_error( "Image not set!" );
 
-    mCurrentCtx.mGeneration++;
     mCurrentCtx.mScale = newScale;
+    mCurrentCtx.mFilters.reset( new FilterCache );
+    NewGeneration();
+}
+
+void ScaledImageFactory::NewGeneration()
+{
+    // in-flight jobs of older generations notice this and bail
+    mCurrentCtx.mGeneration++;
+    mLiveGeneration = mCurrentCtx.mGeneration;
     mJobPool.Clear();
+    CancelSpeculation();
+}
+
+void ScaledImageFactory::CancelSpeculation()
+{
+    mLiveSpeculation++;
+}
+
+bool ScaledImageFactory::IsStale( const Context& ctx ) const
+{
+    if( ctx.mSpeculative )
+        return ctx.mGeneration != mLiveSpeculation.load();
+    return ctx.mGeneration != mLiveGeneration.load();
+}
+
+ScaledImageFactory::Stats ScaledImageFactory::GetStats() const
+{
+    Stats stats;
+    stats.mJobsRendered = mCounters.mJobsRendered.load();
+    stats.mJobsCancelled = mCounters.mJobsCancelled.load();
+    stats.mJobsSkipped = mCounters.mJobsSkipped.load();
+    stats.mPixelsRendered = mCounters.mPixelsRendered.load();
+    stats.mPixelsCancelled = mCounters.mPixelsCancelled.load();
+    return stats;
+}
+
+void ScaledImageFactory::CountJob( std::atomic< size_t >& jobs, std::atomic< size_t >& pixels, const wxRect& area )
+{
+    jobs++;
+    pixels += static_cast< size_t >( area.GetWidth() ) * area.GetHeight();
 }
 
-bool ScaledImageFactory::AddRect( const ExtRect& rect )
+void ScaledImageFactory::SetNaivePreviews( bool naive )
 {
-    if( NULL == mCurrentCtx.mImage )
+    mCurrentCtx.mNaivePreviews = naive;
+    NewGeneration();
+}
+
+bool ScaledImageFactory::AddRect( const ExtRect& rect, bool prefetch )
+{
+    if( NULL == mCurrentCtx.mMipMap )
+        throw std::runtime_error( "Image not set!" );
+
+    JobItem job( rect, mCurrentCtx );
+    job.mPrefetch = prefetch;
+    CancelSpeculation();
+    mJobPool.Post( job, JobKeyFunc( mCenter, mCurrentCtx.mScale )( job ) );
+    return true;
+}
+
+bool ScaledImageFactory::AddBand( const vector< ExtRect >& rects, bool prefetch )
+{
+    if( NULL == mCurrentCtx.mMipMap )
+        throw std::runtime_error( "Image not set!" );
+
+    if( rects.empty() )
+        return true;
+    if( 1 == rects.size() )
+        return AddRect( rects[ 0 ], prefetch );
+
+    JobItem job( rects[ 0 ], mCurrentCtx );
+    job.mPrefetch = prefetch;
+    CancelSpeculation();
+    wxRect& bandRect = get<2>( job.mRect );
+    for( const ExtRect& rect : rects )
+    {
+        const wxRect& tileRect = get<2>( rect );
+        if( get<0>( rect ) != get<0>( job.mRect ) ||
+            get<1>( rect ) != get<1>( job.mRect ) ||
+            tileRect.GetTop() != bandRect.GetTop() ||
+            tileRect.GetHeight() != bandRect.GetHeight() )
+        {
+            throw std::runtime_error( "Band rects must share a frame, filter and row!" );
+        }
+
+        bandRect.Union( tileRect );
+        job.mTiles.push_back( tileRect );
+    }
+
+    mJobPool.Post( job, JobKeyFunc( mCenter, mCurrentCtx.mScale )( job ) );
+    return true;
+}
+
+bool ScaledImageFactory::AddFrameRect( const ExtRect& rect, const AnimationFrame& frame )
+{
+    if( NULL == mCurrentCtx.mMipMap || NULL == frame.GetPixels() )
         throw std::runtime_error( "Image not set!" );
 
-    return( wxSORTABLEMSGQUEUE_NO_ERROR == mJobPool.Post( JobItem( rect, mCurrentCtx ) ) );
+    JobItem job( rect, mCurrentCtx );
+    job.mCtx.mMipMap = GetMipMap( frame );
+    job.mPrefetch = true;
+    CancelSpeculation();
+    mJobPool.Post( job, JobKeyFunc( mCenter, mCurrentCtx.mScale )( job ) );
+    return true;
 }
 
-bool ScaledImageFactory::GetImage( ExtRect& rect, wxImagePtr& image )
+void ScaledImageFactory::RemoveRects( const set< ExtRect >& rects )
+{
+    if( !rects.empty() )
+        mJobPool.RemoveIf( TilesIn( rects ) );
+}
+
+bool ScaledImageFactory::TilesIn::operator()( const JobItem& job ) const
+{
+    // strips, speculation (whose rects are at another scale)
+    // and "kill" jobs are none of the caller's business
+    if( NULL != job.mAssembly || job.mCtx.mSpeculative || NULL == job.mCtx.mMipMap )
+        return false;
+
+    if( job.mTiles.empty() )
+        return mRects.count( job.mRect ) > 0;
+
+    for( const wxRect& tile : job.mTiles )
+    {
+        if( 0 == mRects.count( ExtRect( get<0>( job.mRect ), get<1>( job.mRect ), tile ) ) )
+            return false;
+    }
+    return true;
+}
+
+void ScaledImageFactory::ForgetFrame( const AnimationFrame& frame )
+{
+    if( NULL != frame.GetPixels() )
+        mMipMaps.erase( frame.GetPixels() );
+}
+
+bool ScaledImageFactory::AddSpeculativeRect( const ExtRect& rect, double scale )
+{
+    if( NULL == mCurrentCtx.mMipMap )
+        throw std::runtime_error( "Image not set!" );
+
+    JobItem job( rect, mCurrentCtx );
+    job.mCtx.mScale = scale;
+    job.mCtx.mSpeculative = true;
+    job.mCtx.mGeneration = mLiveSpeculation.load();
+    mJobPool.Post( job, JobKeyFunc( mCenter, mCurrentCtx.mScale )( job ) );
+    return true;
+}
+
+void ScaledImageFactory::AcknowledgeResults()
+{
+    mNotifyPending = false;
+}
+
+bool ScaledImageFactory::GetImage( ExtRect& rect, wxImagePtr& image, double& scale )
 {
     ResultItem item;
-    wxMessageQueueError err;
     while( true )
     {
-        err = mResultQueue.ReceiveTimeout( 0, item );
-        if( wxMSGQUEUE_TIMEOUT == err )
+        if( !mResults.TryPop( item ) )
             return false;
-        if( wxMSGQUEUE_MISC_ERROR == err )
-            throw std::runtime_error( "ResultQueue misc error!" );
-        if( item.mGeneration != mCurrentCtx.mGeneration )
+        if( item.mSpeculative && item.mGeneration != mLiveSpeculation.load() )
+            continue;
+        if( !item.mSpeculative && item.mGeneration != mCurrentCtx.mGeneration )
             continue;
         break;
     }
 
     rect = item.mRect;
     image = item.mImage;
+    scale = item.mScale;
     return true;
 }
 
 void ScaledImageFactory::SetVisibleArea( const wxRect& visible )
 {
-    wxCriticalSectionLocker locker( mVisibleCs );
-    mVisible = visible;
+    {
+        wxCriticalSectionLocker locker( mVisibleCs );
+        mVisible = visible;
+    }
+
+    // small moves barely change the order, don't bother
+    const wxPoint center( visible.GetCentre() );
+    const wxPoint delta( center - mCenter );
+    if( abs( delta.x ) < REPRIORITIZE_DISTANCE && abs( delta.y ) < REPRIORITIZE_DISTANCE )
+        return;
+
+    mCenter = center;
+    mJobPool.Reprioritize( JobKeyFunc( mCenter, mCurrentCtx.mScale ) );
+}
+
+ScaledImageFactory::JobKey ScaledImageFactory::JobKeyFunc::operator()( const JobItem& job ) const
+{
+    // speculative rects are at a scale of their own
+    const wxRect& rect = get<2>( job.mRect );
+    const double factor = ( job.mCtx.mSpeculative ? mScale / job.mCtx.mScale : 1.0 );
+    const double dx = ( rect.GetLeft() + rect.GetWidth() * 0.5 ) * factor - mCenter.x;
+    const double dy = ( rect.GetTop() + rect.GetHeight() * 0.5 ) * factor - mCenter.y;
+    return JobKey( job.mCtx.mSpeculative, job.mPrefetch, get<1>( job.mRect ), dx * dx + dy * dy );
 }
 
 void ScaledImageFactory::Reset()
 {
-    mJobPool.Clear();
-    mResultQueue.Clear();
+    NewGeneration();
+
+    // whatever's left is stale now
+    ResultItem item;
+    while( mResults.TryPop( item ) ) { }
 
-    mCurrentCtx.mGeneration++;
     mCurrentCtx.mScale = 1.0;
-    mCurrentCtx.mImage.reset();
+    mCurrentCtx.mMipMap.reset();
+    mCurrentCtx.mFilters.reset( new FilterCache );
+    mMipMaps.clear();
 }
\ No newline at end of file
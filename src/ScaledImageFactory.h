@@ -4,11 +4,20 @@
 #include <wx/sharedptr.h>
 #include <wx/image.h>
 #include <wx/event.h>
-#include <wx/msgqueue.h>
+#include <wx/atomic.h>
 #include <tuple>
+#include <map>
+#include <set>
+#include <vector>
+#include <atomic>
 
-#include "wxSortableMsgQueue.h"
+#include "WorkStealingQueue.h"
+#include "LockFreeRing.h"
 #include "wxMultiThreadHelper.h"
+#include "MipMap.h"
+#include "LruCache.h"
+#include "BufferPool.h"
+#include "Resampler.h"
 
 
 // (ab)use std::pair<>'s operator<() to compare wxRects
@@ -22,62 +31,307 @@ inline bool operator<( const wxRect& left, const wxRect& right )
 // frame number, filter, rect
 typedef std::tuple< size_t, int, wxRect > ExtRect;
 
+// for hashed containers of ExtRects
+struct ExtRectHash
+{
+    size_t operator()( const ExtRect& rect ) const
+    {
+        const wxRect& r = std::get<2>( rect );
+        size_t h = std::get<0>( rect );
+        Combine( h, static_cast< size_t >( std::get<1>( rect ) ) );
+        Combine( h, static_cast< size_t >( r.x ) );
+        Combine( h, static_cast< size_t >( r.y ) );
+        Combine( h, static_cast< size_t >( r.width ) );
+        Combine( h, static_cast< size_t >( r.height ) );
+
+        // tile positions are multiples of the tile size, so make sure
+        // the low bits get a say in what the high bits are doing
+        h ^= h >> 16;
+        h *= 0x85ebca6b;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35;
+        h ^= h >> 16;
+        return h;
+    }
+
+    static void Combine( size_t& h, const size_t v )
+    {
+        h ^= v + 0x9e3779b9 + ( h << 6 ) + ( h >> 2 );
+    }
+};
+
+// for hashed containers keyed by address
+struct PointerHash
+{
+    size_t operator()( const void* ptr ) const
+    {
+        // heap blocks are aligned, so the low bits never vary on their own
+        size_t h = reinterpret_cast< size_t >( ptr );
+        h ^= h >> 16;
+        h *= 0x85ebca6b;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35;
+        h ^= h >> 16;
+        return h;
+    }
+};
+
+
+// horizontal and vertical filter tables for one (image size, scale, filter)
+struct FilterTables
+{
+    wxSharedPtr< FilterTable > mHoriz;
+    wxSharedPtr< FilterTable > mVert;
+};
+
+// lazily-built filter tables shared by all the jobs of a scale generation
+class FilterCache
+{
+public:
+    // safe to call from multiple threads
+    FilterTables Get( const wxSize& srcSize, double scale, Filter::Type filter );
+
+private:
+    typedef std::tuple< size_t, size_t, double, int > Key;
+    wxMutex mMutex;
+    std::map< Key, FilterTables > mTables;
+};
+
 
 class ScaledImageFactory : public wxMultiThreadHelper
 {
 public:
     typedef wxSharedPtr< wxImage > wxImagePtr;
 
-    ScaledImageFactory( wxEvtHandler* eventSink, int id = wxID_ANY );
+    // how the worker threads get run
+    struct WorkerOptions
+    {
+        WorkerOptions()
+            : mCount( 0 ), mPriority( WXTHREAD_DEFAULT_PRIORITY ), mAffinity( 0 )
+        { }
+
+        size_t mCount;                  // 0 for one less than the number of CPUs
+        unsigned int mPriority;         // WXTHREAD_MIN_PRIORITY to WXTHREAD_MAX_PRIORITY
+        unsigned long long mAffinity;   // bit n allows CPU n, 0 for any CPU
+    };
+
+    ScaledImageFactory( wxEvtHandler* eventSink, int id = wxID_ANY, const WorkerOptions& options = WorkerOptions() );
     ~ScaledImageFactory();
-    void SetImage( wxImagePtr& newImage );
+
+    // replaces the worker threads once they finish what they're rendering;
+    // queued and in-flight jobs are dropped, so re-queue what's still wanted
+    void SetWorkerOptions( const WorkerOptions& options );
+    const WorkerOptions& GetWorkerOptions() const { return mWorkerOptions; }
+    // workers actually running, which may be fewer than asked for
+    size_t GetWorkerCount() const { return GetThreadCount(); }
+    void SetImage( const AnimationFrame& frame );
     void SetScale( double newScale );
-    bool AddRect( const ExtRect& rect );
-    bool GetImage( ExtRect& rect, wxImagePtr& image );
+
+    // filter Box/Triangle tiles gamma-naively instead of in linear light
+    void SetNaivePreviews( bool naive );
+    bool GetNaivePreviews() const { return mCurrentCtx.mNaivePreviews; }
+
+    // prefetch jobs go after everything else and get rendered even
+    // if they're outside the visible area
+    bool AddRect( const ExtRect& rect, bool prefetch = false );
+
+    // renders a run of adjacent tiles in one row as a single job and
+    // posts each tile as its own result; all rects must share a frame,
+    // filter, top and height
+    bool AddBand( const std::vector< ExtRect >& rects, bool prefetch = false );
+
+    // like a prefetch AddRect(), but renders from frame instead of the
+    // current one, for getting animation frames ready before they're shown
+    bool AddFrameRect( const ExtRect& rect, const AnimationFrame& frame );
+
+    // drops the queued jobs none of whose tiles are wanted anymore,
+    // like those of animation frames that went by before they got to them
+    void RemoveRects( const std::set< ExtRect >& rects );
+
+    // drops the mip chain of frame, whose pixels are being let go of so
+    // its source can budget them; jobs already queued keep what they need
+    void ForgetFrame( const AnimationFrame& frame );
+
+    // renders rect at scale instead of the current one when there's
+    // nothing else to do, so tiles are ready if we zoom there; adding any
+    // other job cancels all speculative ones, queued or in-flight
+    bool AddSpeculativeRect( const ExtRect& rect, double scale );
+    void CancelSpeculation();
+
+    // approximate number of queued jobs
+    size_t GetPendingJobs() const { return mJobPool.GetCount(); }
+
+    // results are announced with one wxThreadEvent per batch; call this
+    // from its handler before draining them with GetImage()
+    void AcknowledgeResults();
+    // scale is what the result was rendered at, which only differs from
+    // the current scale for speculative results
+    bool GetImage( ExtRect& rect, wxImagePtr& image, double& scale );
+    // also reprioritizes the queued jobs around the new center
     void SetVisibleArea( const wxRect& visible );
     void Reset();
 
-    // Sort the job queue with the given comparison functor
-    template< class Compare >
-    bool Sort( Compare comp )
+    // the part of the full-size image that rendering rect at scale can
+    // read from, padded out for the mip levels and the filter footprint
+    static wxRect GetSourceRect( const ExtRect& rect, double scale );
+
+    // running totals of what the workers have done
+    struct Stats
     {
-        return ( wxSORTABLEMSGQUEUE_NO_ERROR == mJobPool.Sort( JobItemCmp< Compare >( comp ) ) );
-    }
+        size_t mJobsRendered;
+        size_t mJobsCancelled;      // went stale while queued or mid-render
+        size_t mJobsSkipped;        // scrolled out of view
+        size_t mPixelsRendered;
+        size_t mPixelsCancelled;
+    };
+    Stats GetStats() const;
 
 private:
     virtual wxThread::ExitCode Entry();
 
+    void StartWorkers( const WorkerOptions& options );
+    // cancels everything queued or in flight and waits for the workers to exit
+    void StopWorkers();
+    WorkerOptions mWorkerOptions;
+
     struct Context
     {
         unsigned int mGeneration;
         double mScale;
-        wxImagePtr mImage;
+        bool mNaivePreviews;
+        // mGeneration counts speculation, not scale changes
+        bool mSpeculative;
+        // NULL until an image is set, and for the jobs telling workers to quit
+        MipMapPtr mMipMap;
+        wxSharedPtr< FilterCache > mFilters;
     };
     Context mCurrentCtx;
 
-    typedef std::pair< ExtRect, Context > JobItem;
-    typedef wxSortableMessageQueue< JobItem > JobPoolType;
-    JobPoolType mJobPool;
-
-    template< class Compare >
-    struct JobItemCmp
+    // mip chains of the frames we've been handed lately, keyed by their
+    // pixels; each one pins its frame, so they're held to a budget, and
+    // the ones of frames with a source go as soon as ForgetFrame() says so
+    // queued jobs keep the ones they need alive on their own
+    struct MipMapCost
     {
-        Compare mComp;
-        JobItemCmp( Compare comp ) : mComp( comp ) {}
-        bool operator()( const JobItem& left, const JobItem& right )
+        size_t operator()( const MipMapPtr& mipMap ) const
         {
-            return mComp( left.first, right.first );
+            return mipMap->GetBaseBytes();
         }
     };
+    static const size_t MIPMAP_CACHE_BYTES = 256 * 1024 * 1024;
+    LruCache< const void*, MipMapPtr, PointerHash, MipMapCost > mMipMaps;
+    MipMapPtr GetMipMap( const AnimationFrame& frame );
+
+    // a job split into strips that several workers render into one image
+    struct Assembly
+    {
+        ExtRect mRect;
+        std::vector< wxRect > mTiles;
+        wxImagePtr mImage;
+
+        // strips still being rendered
+        wxAtomicInt mRemaining;
+    };
+
+    struct JobItem
+    {
+        JobItem() : mPrefetch( false ) { }
+        JobItem( const ExtRect& rect, const Context& ctx ) : mRect( rect ), mCtx( ctx ), mPrefetch( false ) { }
+
+        // area to render, and the tiles to split it into if more than one
+        ExtRect mRect;
+        std::vector< wxRect > mTiles;
+        Context mCtx;
+        bool mPrefetch;
+
+        // set if this is one strip of a bigger job
+        wxSharedPtr< Assembly > mAssembly;
+    };
+    // visible area first, then prefetch, then speculation; within those
+    // quicker filters first, then closest to the center of the viewport,
+    // which is at scale
+    typedef std::tuple< bool, bool, int, double > JobKey;
+    struct JobKeyFunc
+    {
+        JobKeyFunc( const wxPoint& center, double scale ) : mCenter( center ), mScale( scale ) {}
+        JobKey operator()( const JobItem& job ) const;
+        wxPoint mCenter;
+        double mScale;
+    };
+
+    // true for jobs all of whose tiles are in mRects
+    struct TilesIn
+    {
+        TilesIn( const std::set< ExtRect >& rects ) : mRects( rects ) {}
+        bool operator()( const JobItem& job ) const;
+        const std::set< ExtRect >& mRects;
+    };
+
+    typedef WorkStealingQueue< JobItem, JobKey > JobPoolType;
+    JobPoolType mJobPool;
+
+    // viewport center the queued jobs are prioritized around, only
+    // touched by the GUI thread
+    wxPoint mCenter;
+    static const int REPRIORITIZE_DISTANCE = 64;    // pixels
 
     struct ResultItem
     {
         unsigned int mGeneration;
+        bool mSpeculative;
+        double mScale;
         ExtRect mRect;
         wxImagePtr mImage;
     };
-    typedef wxMessageQueue< ResultItem > ResultQueueType;
-    ResultQueueType mResultQueue;
+
+    // renders rect into dst, which must be rect-sized; the background
+    // pattern starts at row patternY so strips of one rect line up
+    // returns false if ctx's generation went stale partway through
+    bool Render( wxImage& dst, const ExtRect& rect, const Context& ctx, size_t patternY, ScratchArena& arena );
+
+    // bumps the current generation, cancelling every queued and in-flight job
+    void NewGeneration();
+
+    // mCurrentCtx.mGeneration, for workers to poll
+    std::atomic< unsigned int > mLiveGeneration;
+
+    // bumped by CancelSpeculation()
+    std::atomic< unsigned int > mLiveSpeculation;
+
+    // true if ctx's generation has been superseded
+    bool IsStale( const Context& ctx ) const;
+
+    struct Counters
+    {
+        std::atomic< size_t > mJobsRendered;
+        std::atomic< size_t > mJobsCancelled;
+        std::atomic< size_t > mJobsSkipped;
+        std::atomic< size_t > mPixelsRendered;
+        std::atomic< size_t > mPixelsCancelled;
+    };
+    Counters mCounters;
+    static void CountJob( std::atomic< size_t >& jobs, std::atomic< size_t >& pixels, const wxRect& area );
+
+    // pooled result image
+    wxImagePtr NewTile( const wxSize& size );
+
+    // how many strips to split rect into, 1 for not at all
+    size_t GetStripCount( const ExtRect& rect, const Context& ctx );
+    static const size_t STRIP_COST = 1 << 21;     // multiply-adds
+    static const size_t MIN_STRIP_ROWS = 32;
+
+    // posts the image rendered for rect as one result per tile
+    void Deliver( const ExtRect& rect, const std::vector< wxRect >& tiles, const Context& ctx, const wxImagePtr& image );
+
+    // pixel storage for result tiles; result images only borrow it, so
+    // they must not be copied (as opposed to converted) past their lifetime
+    wxSharedPtr< BufferPool > mTilePool;
+
+    // finished tiles on their way to the GUI thread, which gets at most
+    // one event at a time telling it to come and get them
+    static const size_t RESULT_RING_SIZE = 4096;
+    LockFreeRing< ResultItem > mResults;
+    std::atomic< bool > mNotifyPending;
 
     wxEvtHandler* mEventSink;
     int mEventId;
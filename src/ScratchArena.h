@@ -0,0 +1,89 @@
+#ifndef SCRATCHARENA_H
+#define SCRATCHARENA_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <vector>
+#include <new>
+
+
+// bump allocator for short-lived per-job scratch memory
+// meant to be owned by a single thread; Reset() releases everything at once
+// and once it has grown to a job's high-water mark it stops allocating
+class ScratchArena
+{
+public:
+    ScratchArena()
+        : mBlock( NULL ), mCapacity( 0 ), mUsed( 0 ), mOverflowBytes( 0 )
+    { }
+
+    ~ScratchArena()
+    {
+        Reset();
+        free( mBlock );
+    }
+
+    // returns size bytes aligned to ALIGNMENT
+    void* Alloc( size_t size )
+    {
+        size = ( size + ALIGNMENT - 1 ) & ~( ALIGNMENT - 1 );
+        if( mUsed + size <= mCapacity )
+        {
+            void* ptr = mBlock + mUsed;
+            mUsed += size;
+            return ptr;
+        }
+
+        // doesn't fit, hand out a one-off block until the next Reset()
+        // and remember to grow the main block then
+        void* ptr = malloc( size );
+        if( NULL == ptr )
+            throw std::bad_alloc();
+        mOverflow.push_back( ptr );
+        mOverflowBytes += size;
+        return ptr;
+    }
+
+    template< typename T >
+    T* Alloc( size_t count )
+    {
+        return static_cast< T* >( Alloc( count * sizeof( T ) ) );
+    }
+
+    void Reset()
+    {
+        if( !mOverflow.empty() )
+        {
+            for( size_t i = 0; i < mOverflow.size(); ++i )
+            {
+                free( mOverflow[ i ] );
+            }
+            mOverflow.clear();
+
+            // grow so the same workload fits in one block next time
+            const size_t newCapacity = mUsed + mOverflowBytes;
+            free( mBlock );
+            mBlock = static_cast< unsigned char* >( malloc( newCapacity ) );
+            mCapacity = ( NULL != mBlock ) ? newCapacity : 0;
+            mOverflowBytes = 0;
+        }
+
+        mUsed = 0;
+    }
+
+private:
+    static const size_t ALIGNMENT = 16;
+
+    unsigned char* mBlock;
+    size_t mCapacity;
+    size_t mUsed;
+
+    std::vector< void* > mOverflow;
+    size_t mOverflowBytes;
+
+    // no copy ctor/assignment operator
+    ScratchArena( const ScratchArena& );
+    ScratchArena& operator=( const ScratchArena& );
+};
+
+#endif
@@ -0,0 +1,508 @@
+#include "TileKernels.h"
+
+#include <cstring>
+#include <algorithm>
+
+#if defined( _MSC_VER ) && ( defined( _M_IX86 ) || defined( _M_X64 ) )
+    #include <intrin.h>
+    #include <immintrin.h>
+    #define TILEKERNELS_X86
+    #define TARGET_SSE41
+    #define TARGET_AVX2
+#elif defined( __GNUC__ ) && ( defined( __i386__ ) || defined( __x86_64__ ) )
+    #include <cpuid.h>
+    #include <immintrin.h>
+    #define TILEKERNELS_X86
+    #define TARGET_SSE41 __attribute__(( target( "sse4.1" ) ))
+    #define TARGET_AVX2 __attribute__(( target( "avx2" ) ))
+#endif
+
+using namespace std;
+
+
+// instruction sets we have kernels for, best last
+enum SimdLevel
+{
+    SIMD_SCALAR,
+    SIMD_SSE41,
+    SIMD_AVX2,
+};
+
+SimdLevel DetectSimdLevel()
+{
+#if defined( TILEKERNELS_X86 )
+    unsigned int regs[ 4 ] = { 0, 0, 0, 0 };
+    unsigned int maxLeaf = 0;
+
+    #if defined( _MSC_VER )
+        int info[ 4 ];
+        __cpuid( info, 0 );
+        maxLeaf = info[ 0 ];
+        __cpuid( info, 1 );
+        memcpy( regs, info, sizeof( regs ) );
+    #else
+        maxLeaf = __get_cpuid_max( 0, NULL );
+        __get_cpuid( 1, &regs[ 0 ], &regs[ 1 ], &regs[ 2 ], &regs[ 3 ] );
+    #endif
+
+    const bool sse41 = ( regs[ 2 ] & ( 1 << 19 ) ) != 0;
+    const bool osxsave = ( regs[ 2 ] & ( 1 << 27 ) ) != 0;
+    const bool avx = ( regs[ 2 ] & ( 1 << 28 ) ) != 0;
+    if( !sse41 )
+        return SIMD_SCALAR;
+
+    // AVX2 also needs the OS to save the upper halves of the ymm registers
+    if( maxLeaf >= 7 && osxsave && avx )
+    {
+        #if defined( _MSC_VER )
+            const unsigned long long xcr0 = _xgetbv( 0 );
+            __cpuidex( info, 7, 0 );
+            memcpy( regs, info, sizeof( regs ) );
+        #else
+            unsigned int xcr0Lo = 0, xcr0Hi = 0;
+            __asm__( "xgetbv" : "=a"( xcr0Lo ), "=d"( xcr0Hi ) : "c"( 0 ) );
+            const unsigned long long xcr0 = xcr0Lo;
+            __cpuid_count( 7, 0, regs[ 0 ], regs[ 1 ], regs[ 2 ], regs[ 3 ] );
+        #endif
+
+        const bool avx2 = ( regs[ 1 ] & ( 1 << 5 ) ) != 0;
+        if( avx2 && ( xcr0 & 6 ) == 6 )
+            return SIMD_AVX2;
+    }
+
+    return SIMD_SSE41;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+// initialized at startup so workers never race on it
+static const SimdLevel sSimdLevel = DetectSimdLevel();
+
+
+void BuildNearestTable
+    (
+    unsigned int* table,
+    const int offset,
+    const size_t count,
+    const double scale,
+    const size_t srcSize
+    )
+{
+    const unsigned int maxIdx = static_cast< unsigned int >( srcSize - 1 );
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        const double pos = ( static_cast< double >( i ) + offset ) / scale;
+        const unsigned int idx = pos > 0.0 ? static_cast< unsigned int >( pos ) : 0;
+        table[ i ] = min( idx, maxIdx );
+    }
+}
+
+
+void NearestRowScalar
+    (
+    unsigned char* dst,
+    const unsigned char* srcRow,
+    const unsigned int* cols,
+    const size_t begin,
+    const size_t count,
+    const size_t channels
+    )
+{
+    if( channels == 3 )
+    {
+        for( size_t x = begin; x < count; ++x )
+        {
+            const unsigned char* srcPx = &srcRow[ cols[ x ] * 3 ];
+            dst[ x * 3 + 0 ] = srcPx[ 0 ];
+            dst[ x * 3 + 1 ] = srcPx[ 1 ];
+            dst[ x * 3 + 2 ] = srcPx[ 2 ];
+        }
+    }
+    else
+    {
+        for( size_t x = begin; x < count; ++x )
+        {
+            dst[ x ] = srcRow[ cols[ x ] ];
+        }
+    }
+}
+
+
+void PaletteRowScalar
+    (
+    unsigned char* dst,
+    const unsigned char* indices,
+    const unsigned char* palette,
+    const size_t begin,
+    const size_t count,
+    const size_t channels
+    )
+{
+    if( channels == 3 )
+    {
+        for( size_t x = begin; x < count; ++x )
+        {
+            const unsigned char* entry = &palette[ indices[ x ] * 4 ];
+            dst[ x * 3 + 0 ] = entry[ 0 ];
+            dst[ x * 3 + 1 ] = entry[ 1 ];
+            dst[ x * 3 + 2 ] = entry[ 2 ];
+        }
+    }
+    else
+    {
+        for( size_t x = begin; x < count; ++x )
+        {
+            dst[ x ] = palette[ indices[ x ] * 4 + 3 ];
+        }
+    }
+}
+
+
+// blends a foreground RGB triplet (fg) onto a background RGB triplet (bg)
+// using the given alpha value; returns the blended result
+// http://stackoverflow.com/questions/12011081/alpha-blending-2-rgba-colors-in-c/12016968#12016968
+inline void BlendRgb
+    (
+    unsigned char* dst,
+    const unsigned char* fg,
+    const unsigned char* bg,
+    const unsigned char alpha
+    )
+{
+    const unsigned int intAlpha = alpha + 1;
+    const unsigned int invAlpha = 256 - alpha;
+    for( size_t i = 0; i < 3; ++i )
+    {
+        dst[i] = ( ( intAlpha * fg[i] + invAlpha * bg[i] ) >> 8 );
+    }
+}
+
+void BlendRowScalar
+    (
+    unsigned char* dst,
+    const unsigned char* fg,
+    const unsigned char* alpha,
+    const unsigned char* bgRow,
+    const size_t bgW,
+    const size_t begin,
+    const size_t count
+    )
+{
+    for( size_t x = begin; x < count; ++x )
+    {
+        const unsigned char* bgPx = &bgRow[ ( x & ( bgW - 1 ) ) * 3 ];
+        BlendRgb( &dst[ x * 3 ], &fg[ x * 3 ], bgPx, alpha[ x ] );
+    }
+}
+
+
+#if defined( TILEKERNELS_X86 )
+
+// unaligned 32-bit load that doesn't upset strict aliasing
+inline int LoadU32( const unsigned char* ptr )
+{
+    int val;
+    memcpy( &val, ptr, sizeof( val ) );
+    return val;
+}
+
+inline void StoreU32( unsigned char* ptr, int val )
+{
+    memcpy( ptr, &val, sizeof( val ) );
+}
+
+// 4 RGB pixels per iteration: 32-bit loads, pshufb squeezes out
+// the 4th byte of each and 12 bytes get stored
+TARGET_SSE41 size_t NearestRowRgbSse41
+    (
+    unsigned char* dst,
+    const unsigned char* srcRow,
+    const unsigned int* cols,
+    const size_t count,
+    const size_t srcW
+    )
+{
+    const __m128i pack = _mm_setr_epi8( 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1 );
+
+    size_t x = 0;
+    for( ; x + 4 <= count; x += 4 )
+    {
+        // 32-bit loads read one byte past the pixel, stay inside the row
+        if( cols[ x + 3 ] + 2 > srcW )
+            break;
+
+        __m128i px = _mm_cvtsi32_si128( LoadU32( &srcRow[ cols[ x + 0 ] * 3 ] ) );
+        px = _mm_insert_epi32( px, LoadU32( &srcRow[ cols[ x + 1 ] * 3 ] ), 1 );
+        px = _mm_insert_epi32( px, LoadU32( &srcRow[ cols[ x + 2 ] * 3 ] ), 2 );
+        px = _mm_insert_epi32( px, LoadU32( &srcRow[ cols[ x + 3 ] * 3 ] ), 3 );
+        px = _mm_shuffle_epi8( px, pack );
+
+        _mm_storel_epi64( reinterpret_cast< __m128i* >( &dst[ x * 3 ] ), px );
+        StoreU32( &dst[ x * 3 + 8 ], _mm_extract_epi32( px, 2 ) );
+    }
+    return x;
+}
+
+// 8 RGB pixels per iteration via a hardware gather
+TARGET_AVX2 size_t NearestRowRgbAvx2
+    (
+    unsigned char* dst,
+    const unsigned char* srcRow,
+    const unsigned int* cols,
+    const size_t count,
+    const size_t srcW
+    )
+{
+    const __m256i pack = _mm256_setr_epi8
+        (
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1
+        );
+    const __m256i three = _mm256_set1_epi32( 3 );
+    const int* base = reinterpret_cast< const int* >( srcRow );
+
+    size_t x = 0;
+    for( ; x + 8 <= count; x += 8 )
+    {
+        if( cols[ x + 7 ] + 2 > srcW )
+            break;
+
+        const __m256i idx = _mm256_mullo_epi32
+            (
+            _mm256_loadu_si256( reinterpret_cast< const __m256i* >( &cols[ x ] ) ),
+            three
+            );
+        const __m256i px = _mm256_shuffle_epi8( _mm256_i32gather_epi32( base, idx, 1 ), pack );
+
+        const __m128i lo = _mm256_castsi256_si128( px );
+        const __m128i hi = _mm256_extracti128_si256( px, 1 );
+        _mm_storel_epi64( reinterpret_cast< __m128i* >( &dst[ x * 3 + 0 ] ), lo );
+        StoreU32( &dst[ x * 3 + 8 ], _mm_extract_epi32( lo, 2 ) );
+        _mm_storel_epi64( reinterpret_cast< __m128i* >( &dst[ x * 3 + 12 ] ), hi );
+        StoreU32( &dst[ x * 3 + 20 ], _mm_extract_epi32( hi, 2 ) );
+    }
+    return x;
+}
+
+// 8 alpha samples per iteration via a hardware gather
+TARGET_AVX2 size_t NearestRowAlphaAvx2
+    (
+    unsigned char* dst,
+    const unsigned char* srcRow,
+    const unsigned int* cols,
+    const size_t count,
+    const size_t srcW
+    )
+{
+    const __m256i pack = _mm256_setr_epi8
+        (
+        0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+        );
+    const int* base = reinterpret_cast< const int* >( srcRow );
+
+    size_t x = 0;
+    for( ; x + 8 <= count; x += 8 )
+    {
+        if( cols[ x + 7 ] + 4 > srcW )
+            break;
+
+        const __m256i idx = _mm256_loadu_si256( reinterpret_cast< const __m256i* >( &cols[ x ] ) );
+        const __m256i px = _mm256_shuffle_epi8( _mm256_i32gather_epi32( base, idx, 1 ), pack );
+
+        const __m128i packed = _mm_unpacklo_epi32
+            (
+            _mm256_castsi256_si128( px ),
+            _mm256_extracti128_si256( px, 1 )
+            );
+        _mm_storel_epi64( reinterpret_cast< __m128i* >( &dst[ x ] ), packed );
+    }
+    return x;
+}
+
+// 8 pixels per iteration: the indices are widened and used to gather
+// whole RGBA palette entries, then squeezed down to RGB or alpha
+TARGET_AVX2 size_t PaletteRowAvx2
+    (
+    unsigned char* dst,
+    const unsigned char* indices,
+    const unsigned char* palette,
+    const size_t count,
+    const size_t channels
+    )
+{
+    const __m256i packRgb = _mm256_setr_epi8
+        (
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1
+        );
+    const __m256i packAlpha = _mm256_setr_epi8
+        (
+        3, 7, 11, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        3, 7, 11, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+        );
+    const int* base = reinterpret_cast< const int* >( palette );
+
+    size_t x = 0;
+    for( ; x + 8 <= count; x += 8 )
+    {
+        const __m256i idx = _mm256_cvtepu8_epi32( _mm_loadl_epi64( reinterpret_cast< const __m128i* >( &indices[ x ] ) ) );
+        const __m256i entries = _mm256_i32gather_epi32( base, idx, 4 );
+
+        if( channels == 3 )
+        {
+            const __m256i px = _mm256_shuffle_epi8( entries, packRgb );
+            const __m128i lo = _mm256_castsi256_si128( px );
+            const __m128i hi = _mm256_extracti128_si256( px, 1 );
+            _mm_storel_epi64( reinterpret_cast< __m128i* >( &dst[ x * 3 + 0 ] ), lo );
+            StoreU32( &dst[ x * 3 + 8 ], _mm_extract_epi32( lo, 2 ) );
+            _mm_storel_epi64( reinterpret_cast< __m128i* >( &dst[ x * 3 + 12 ] ), hi );
+            StoreU32( &dst[ x * 3 + 20 ], _mm_extract_epi32( hi, 2 ) );
+        }
+        else
+        {
+            const __m256i px = _mm256_shuffle_epi8( entries, packAlpha );
+            const __m128i packed = _mm_unpacklo_epi32
+                (
+                _mm256_castsi256_si128( px ),
+                _mm256_extracti128_si256( px, 1 )
+                );
+            _mm_storel_epi64( reinterpret_cast< __m128i* >( &dst[ x ] ), packed );
+        }
+    }
+    return x;
+}
+
+// 4 RGB pixels per iteration, same math as BlendRgb() in 16-bit lanes:
+// ( alpha + 1 ) * fg + ( 256 - alpha ) * bg never exceeds 0xFFFF
+TARGET_SSE41 size_t BlendRowSse41
+    (
+    unsigned char* dst,
+    const unsigned char* fg,
+    const unsigned char* alpha,
+    const unsigned char* bgRow,
+    const size_t bgW,
+    const size_t count
+    )
+{
+    // groups of 4 must not straddle the end of the background row
+    if( bgW % 4 != 0 )
+        return 0;
+
+    const __m128i spread = _mm_setr_epi8( 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, -1, -1, -1, -1 );
+    const __m128i one = _mm_set1_epi16( 1 );
+    const __m128i full = _mm_set1_epi16( 256 );
+
+    size_t x = 0;
+    for( ; x + 4 <= count; x += 4 )
+    {
+        const unsigned char* bgPx = &bgRow[ ( x & ( bgW - 1 ) ) * 3 ];
+
+        __m128i fgPx = _mm_loadl_epi64( reinterpret_cast< const __m128i* >( &fg[ x * 3 ] ) );
+        fgPx = _mm_insert_epi32( fgPx, LoadU32( &fg[ x * 3 + 8 ] ), 2 );
+        __m128i bgPx8 = _mm_loadl_epi64( reinterpret_cast< const __m128i* >( bgPx ) );
+        bgPx8 = _mm_insert_epi32( bgPx8, LoadU32( &bgPx[ 8 ] ), 2 );
+        const __m128i a = _mm_shuffle_epi8( _mm_cvtsi32_si128( LoadU32( &alpha[ x ] ) ), spread );
+
+        const __m128i aLo = _mm_cvtepu8_epi16( a );
+        const __m128i aHi = _mm_cvtepu8_epi16( _mm_srli_si128( a, 8 ) );
+
+        const __m128i lo = _mm_srli_epi16
+            (
+            _mm_add_epi16
+                (
+                _mm_mullo_epi16( _mm_cvtepu8_epi16( fgPx ), _mm_add_epi16( aLo, one ) ),
+                _mm_mullo_epi16( _mm_cvtepu8_epi16( bgPx8 ), _mm_sub_epi16( full, aLo ) )
+                ),
+            8
+            );
+        const __m128i hi = _mm_srli_epi16
+            (
+            _mm_add_epi16
+                (
+                _mm_mullo_epi16( _mm_cvtepu8_epi16( _mm_srli_si128( fgPx, 8 ) ), _mm_add_epi16( aHi, one ) ),
+                _mm_mullo_epi16( _mm_cvtepu8_epi16( _mm_srli_si128( bgPx8, 8 ) ), _mm_sub_epi16( full, aHi ) )
+                ),
+            8
+            );
+
+        const __m128i px = _mm_packus_epi16( lo, hi );
+        _mm_storel_epi64( reinterpret_cast< __m128i* >( &dst[ x * 3 ] ), px );
+        StoreU32( &dst[ x * 3 + 8 ], _mm_extract_epi32( px, 2 ) );
+    }
+    return x;
+}
+
+#endif
+
+
+void NearestRow
+    (
+    unsigned char* dst,
+    const unsigned char* srcRow,
+    const unsigned int* cols,
+    const size_t count,
+    const size_t srcW,
+    const size_t channels
+    )
+{
+    // vector kernels do the bulk and hand back how far they got
+    size_t done = 0;
+#if defined( TILEKERNELS_X86 )
+    if( channels == 3 )
+    {
+        if( sSimdLevel >= SIMD_AVX2 )
+            done = NearestRowRgbAvx2( dst, srcRow, cols, count, srcW );
+        else if( sSimdLevel >= SIMD_SSE41 )
+            done = NearestRowRgbSse41( dst, srcRow, cols, count, srcW );
+    }
+    else if( channels == 1 )
+    {
+        if( sSimdLevel >= SIMD_AVX2 )
+            done = NearestRowAlphaAvx2( dst, srcRow, cols, count, srcW );
+    }
+#endif
+
+    NearestRowScalar( dst, srcRow, cols, done, count, channels );
+}
+
+
+void BlendRow
+    (
+    unsigned char* dst,
+    const unsigned char* fg,
+    const unsigned char* alpha,
+    const unsigned char* bgRow,
+    const size_t bgW,
+    const size_t count
+    )
+{
+    size_t done = 0;
+#if defined( TILEKERNELS_X86 )
+    if( sSimdLevel >= SIMD_SSE41 )
+        done = BlendRowSse41( dst, fg, alpha, bgRow, bgW, count );
+#endif
+
+    BlendRowScalar( dst, fg, alpha, bgRow, bgW, done, count );
+}
+
+
+void PaletteRow
+    (
+    unsigned char* dst,
+    const unsigned char* indices,
+    const unsigned char* palette,
+    const size_t count,
+    const size_t channels
+    )
+{
+    size_t done = 0;
+#if defined( TILEKERNELS_X86 )
+    if( sSimdLevel >= SIMD_AVX2 )
+        done = PaletteRowAvx2( dst, indices, palette, count, channels );
+#endif
+
+    PaletteRowScalar( dst, indices, palette, done, count, channels );
+}
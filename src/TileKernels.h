@@ -0,0 +1,55 @@
+#ifndef TILEKERNELS_H
+#define TILEKERNELS_H
+
+#include <cstddef>
+
+
+// fills count entries of table with the nearest source index for each of count
+// destination samples starting at offset, clamped to [0, srcSize)
+void BuildNearestTable
+    (
+    unsigned int* table,
+    const int offset,
+    const size_t count,
+    const double scale,
+    const size_t srcSize
+    );
+
+// gathers count pixels from srcRow into dst using the source pixel
+// indices in cols; channels must be 1 (alpha) or 3 (RGB)
+// srcW is the width of srcRow in pixels, used to keep vector loads in-bounds
+void NearestRow
+    (
+    unsigned char* dst,
+    const unsigned char* srcRow,
+    const unsigned int* cols,
+    const size_t count,
+    const size_t srcW,
+    const size_t channels
+    );
+
+// looks up count 8-bit indices in palette, which holds 256 RGBA entries,
+// writing either their colors (channels 3) or their alpha (channels 1)
+void PaletteRow
+    (
+    unsigned char* dst,
+    const unsigned char* indices,
+    const unsigned char* palette,
+    const size_t count,
+    const size_t channels
+    );
+
+// composites count RGB pixels from fg using the per-pixel alpha onto
+// a repeating background row of bgW RGB pixels into dst
+// bgW must be a power of two; dst may alias fg
+void BlendRow
+    (
+    unsigned char* dst,
+    const unsigned char* fg,
+    const unsigned char* alpha,
+    const unsigned char* bgRow,
+    const size_t bgW,
+    const size_t count
+    );
+
+#endif
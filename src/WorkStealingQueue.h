@@ -0,0 +1,337 @@
+#ifndef WORKSTEALINGQUEUE_H
+#define WORKSTEALINGQUEUE_H
+
+#include <wx/thread.h>
+
+#include <atomic>
+#include <algorithm>
+#include <vector>
+#include <utility>
+
+
+// job queue for a fixed set of worker threads
+// producers push onto a lock-free injection stack; workers move what's
+// there into per-worker heaps (each behind its own lock, so workers only
+// contend when stealing) and pop the entry with the smallest key from their
+// own heap, stealing from the others when it runs dry
+// Clear() cancels everything queued so far by bumping an epoch, then
+// sweeps the stale entries out so they don't linger in GetCount() or hold
+// on to whatever they own; anything posted concurrently that still got
+// the old epoch gets dropped when a worker comes across it
+template< typename T, typename Key >
+class WorkStealingQueue
+{
+public:
+    WorkStealingQueue( size_t workers = 1 )
+        : mInjected( NULL ), mEpoch( 0 ), mCount( 0 ), mSleepers( 0 ), mNextWorker( 0 )
+    {
+        Resize( workers );
+    }
+
+    ~WorkStealingQueue()
+    {
+        FreeList( mInjected.exchange( NULL ) );
+        Resize( 0 );
+    }
+
+    // sets the number of workers, which must all be gone
+    // whatever is still queued gets dealt out among the new ones
+    void Resize( size_t workers )
+    {
+        std::vector< Entry > queued;
+        for( size_t i = 0; i < mWorkers.size(); ++i )
+        {
+            queued.insert( queued.end(), mWorkers[ i ]->mHeap.begin(), mWorkers[ i ]->mHeap.end() );
+            delete mWorkers[ i ];
+        }
+        mWorkers.clear();
+
+        for( size_t i = 0; i < workers; ++i )
+        {
+            mWorkers.push_back( new Worker );
+        }
+        mNextWorker = 0;
+
+        if( mWorkers.empty() )
+        {
+            mCount -= queued.size();
+            return;
+        }
+
+        for( size_t i = 0; i < queued.size(); ++i )
+        {
+            mWorkers[ i % mWorkers.size() ]->mHeap.push_back( queued[ i ] );
+        }
+        for( size_t i = 0; i < mWorkers.size(); ++i )
+        {
+            std::vector< Entry >& heap = mWorkers[ i ]->mHeap;
+            std::make_heap( heap.begin(), heap.end(), EntryCmp() );
+        }
+    }
+
+    // hands out worker indices for Receive(), call once per worker thread
+    size_t AttachWorker()
+    {
+        return mNextWorker++ % mWorkers.size();
+    }
+
+    // safe to call from any thread
+    void Post( const T& msg, const Key& key )
+    {
+        Push( Entry( false, key, msg ) );
+    }
+
+    // queues msg ahead of everything posted with a key
+    void PostFront( const T& msg )
+    {
+        Push( Entry( true, Key(), msg ) );
+    }
+
+    // drops everything queued so far
+    void Clear()
+    {
+        mEpoch++;
+        Sweep( EpochIs( mEpoch.load() ) );
+    }
+
+    // drops the queued entries pred( msg ) is true for
+    template< class Pred >
+    void RemoveIf( Pred pred )
+    {
+        Sweep( LiveUnless< Pred >( mEpoch.load(), pred ) );
+    }
+
+    // recomputes the key of every queued entry with keyFunc( msg )
+    template< class KeyFunc >
+    void Reprioritize( KeyFunc keyFunc )
+    {
+        for( size_t i = 0; i < mWorkers.size(); ++i )
+        {
+            Worker& worker = *mWorkers[ i ];
+            wxCriticalSectionLocker locker( worker.mCs );
+            for( size_t j = 0; j < worker.mHeap.size(); ++j )
+            {
+                Entry& entry = worker.mHeap[ j ];
+                if( !entry.mFront )
+                    entry.mKey = keyFunc( entry.mMsg );
+            }
+            std::make_heap( worker.mHeap.begin(), worker.mHeap.end(), EntryCmp() );
+        }
+    }
+
+    // approximate number of queued entries, only good for heuristics
+    size_t GetCount() const
+    {
+        return mCount.load();
+    }
+
+    // blocks until there's something for this worker
+    void Receive( size_t worker, T& msg )
+    {
+        while( true )
+        {
+            if( TryReceive( worker, msg ) )
+                return;
+
+            // announce we're going to sleep before the last look so a
+            // concurrent Push() either gets seen or wakes us up
+            mSleepers++;
+            if( TryReceive( worker, msg ) )
+            {
+                mSleepers--;
+                return;
+            }
+            mWake.Wait();
+            mSleepers--;
+        }
+    }
+
+private:
+    struct Entry
+    {
+        Entry() : mFront( false ), mEpoch( 0 ) { }
+        Entry( bool front, const Key& key, const T& msg )
+            : mFront( front ), mEpoch( 0 ), mKey( key ), mMsg( msg )
+        { }
+
+        bool mFront;
+        unsigned int mEpoch;
+        Key mKey;
+        T mMsg;
+    };
+
+    // std::*_heap() keep the largest element on top, so compare backwards
+    struct EntryCmp
+    {
+        bool operator()( const Entry& left, const Entry& right ) const
+        {
+            if( left.mFront != right.mFront )
+                return right.mFront;
+            return right.mKey < left.mKey;
+        }
+    };
+
+    struct EpochIs
+    {
+        EpochIs( unsigned int epoch ) : mEpoch( epoch ) { }
+        bool operator()( const Entry& entry ) const
+        {
+            return entry.mEpoch == mEpoch;
+        }
+        unsigned int mEpoch;
+    };
+
+    template< class Pred >
+    struct LiveUnless
+    {
+        LiveUnless( unsigned int epoch, Pred pred ) : mEpoch( epoch ), mPred( pred ) { }
+        bool operator()( const Entry& entry ) const
+        {
+            return entry.mEpoch == mEpoch && !mPred( entry.mMsg );
+        }
+        unsigned int mEpoch;
+        Pred mPred;
+    };
+
+    struct Node
+    {
+        Entry mEntry;
+        Node* mNext;
+    };
+
+    struct Worker
+    {
+        wxCriticalSection mCs;
+        std::vector< Entry > mHeap;
+    };
+
+    void Push( const Entry& entry )
+    {
+        Node* node = new Node;
+        node->mEntry = entry;
+        node->mEntry.mEpoch = mEpoch.load();
+        node->mNext = mInjected.load();
+        while( !mInjected.compare_exchange_weak( node->mNext, node ) )
+        {
+        }
+        mCount++;
+
+        if( mSleepers.load() > 0 )
+            mWake.Post();
+    }
+
+    static void FreeList( Node* node )
+    {
+        while( NULL != node )
+        {
+            Node* next = node->mNext;
+            delete node;
+            node = next;
+        }
+    }
+
+    // moves everything on the injection stack into the worker heaps,
+    // dealt out round-robin so every heap gets a share of the good stuff
+    void Distribute( size_t first )
+    {
+        Node* node = mInjected.exchange( NULL );
+        size_t moved = 0;
+        for( size_t i = first; NULL != node; ++i, ++moved )
+        {
+            Worker& worker = *mWorkers[ i % mWorkers.size() ];
+            {
+                wxCriticalSectionLocker locker( worker.mCs );
+                worker.mHeap.push_back( node->mEntry );
+                std::push_heap( worker.mHeap.begin(), worker.mHeap.end(), EntryCmp() );
+            }
+
+            Node* next = node->mNext;
+            delete node;
+            node = next;
+        }
+
+        // a worker that took its last look while these were in transit
+        // went to sleep on them, and its wakeup may have been spent on
+        // somebody else; the caller takes one, wake others for the rest
+        const int sleepers = mSleepers.load();
+        for( size_t i = 1; i < moved && static_cast< int >( i ) <= sleepers; ++i )
+        {
+            mWake.Post();
+        }
+    }
+
+    // erases every queued entry keep( entry ) is false for
+    template< class KeepFunc >
+    void Sweep( KeepFunc keep )
+    {
+        if( mWorkers.empty() )
+            return;
+
+        Distribute( 0 );
+        for( size_t i = 0; i < mWorkers.size(); ++i )
+        {
+            Worker& worker = *mWorkers[ i ];
+            wxCriticalSectionLocker locker( worker.mCs );
+            const typename std::vector< Entry >::iterator dead = std::partition
+                (
+                worker.mHeap.begin(),
+                worker.mHeap.end(),
+                keep
+                );
+            mCount -= static_cast< size_t >( worker.mHeap.end() - dead );
+            worker.mHeap.erase( dead, worker.mHeap.end() );
+            std::make_heap( worker.mHeap.begin(), worker.mHeap.end(), EntryCmp() );
+        }
+    }
+
+    // pops the best live entry off of the given worker's heap
+    bool TryPop( Worker& worker, T& msg )
+    {
+        wxCriticalSectionLocker locker( worker.mCs );
+        while( !worker.mHeap.empty() )
+        {
+            std::pop_heap( worker.mHeap.begin(), worker.mHeap.end(), EntryCmp() );
+            const Entry& entry = worker.mHeap.back();
+            const bool live = ( entry.mEpoch == mEpoch.load() );
+            if( live )
+                msg = entry.mMsg;
+            worker.mHeap.pop_back();
+            mCount--;
+            if( live )
+                return true;
+        }
+        return false;
+    }
+
+    bool TryReceive( size_t worker, T& msg )
+    {
+        if( NULL != mInjected.load() )
+            Distribute( worker );
+
+        if( TryPop( *mWorkers[ worker ], msg ) )
+            return true;
+
+        // steal
+        for( size_t i = 1; i < mWorkers.size(); ++i )
+        {
+            if( TryPop( *mWorkers[ ( worker + i ) % mWorkers.size() ], msg ) )
+                return true;
+        }
+
+        return false;
+    }
+
+    std::vector< Worker* > mWorkers;
+    std::atomic< Node* > mInjected;
+    std::atomic< unsigned int > mEpoch;
+    std::atomic< size_t > mCount;
+    std::atomic< int > mSleepers;
+    std::atomic< size_t > mNextWorker;
+    wxSemaphore mWake;
+
+    // no copy ctor/assignment operator
+    WorkStealingQueue( const WorkStealingQueue& );
+    WorkStealingQueue& operator=( const WorkStealingQueue& );
+};
+
+#endif
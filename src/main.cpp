@@ -2,115 +2,20 @@
 #include <wx/dcbuffer.h>
 
 #include <wx/wfstream.h>
-#include <wx/gifdecod.h>
-#include <wx/anidecod.h>
 #include <wx/image.h>
 #include <wx/cmdline.h>
 
 #include <wx/dir.h>
 #include <wx/filename.h>
 
+#include <algorithm>
+
 #include "ImagePanel.h"
+#include "ImageLoader.h"
+#include "FilePrefetcher.h"
 
 using namespace std;
 
-// breaks an animation into a sequence of frames
-// todo: re-write without using GUI objects (wxMemoryDC, wxBitmap)
-vector< AnimationFrame > LoadAnimation( wxAnimationDecoder& ad, wxInputStream& stream )
-{
-    vector< AnimationFrame > frames;
-
-    if( !ad.Load( stream ) )
-        return frames;
-
-    wxBitmap frame( ad.GetAnimationSize() );
-    wxMemoryDC dc( frame );
-    dc.SetBackground( wxBrush( ad.GetBackgroundColour() ) );
-    dc.Clear();
-
-    frames.resize( ad.GetFrameCount() );
-    for( unsigned int i = 0; i < frames.size(); ++i )
-    {
-        const wxRect frameRect( ad.GetFramePosition( i ), ad.GetFrameSize( i ) );
-
-        wxBitmap prvBitmap;
-        if( wxANIM_TOPREVIOUS == ad.GetDisposalMethod( i ) )
-        {
-            dc.SelectObject( wxNullBitmap );
-            prvBitmap = frame.GetSubBitmap( frameRect );
-            dc.SelectObject( frame );
-        }
-
-        wxImage img;
-        ad.ConvertToImage( i, &img );
-        dc.DrawBitmap( wxBitmap( img ), frameRect.GetPosition(), true );
-
-        dc.SelectObject( wxNullBitmap );
-        frames[ i ].mImage = new wxImage( frame.ConvertToImage() );
-        frames[ i ].mDelay = static_cast< unsigned int >( ad.GetDelay( i ) );
-        dc.SelectObject( frame );
-
-        switch( ad.GetDisposalMethod( i ) )
-        {
-            case wxANIM_DONOTREMOVE:
-            case wxANIM_UNSPECIFIED:
-                break;
-            case wxANIM_TOBACKGROUND:
-                dc.SetBrush( wxBrush( ad.GetBackgroundColour() ) );
-                dc.SetPen( *wxTRANSPARENT_PEN );
-                dc.DrawRectangle( frameRect );
-                break;
-            case wxANIM_TOPREVIOUS:
-                dc.DrawBitmap( prvBitmap, frameRect.GetPosition(), true );
-                break;
-            default:
-                break;
-        }
-    }
-
-    return frames;
-}
-
-
-// load a (possibly multi-frame) image from a stream
-vector< AnimationFrame > LoadImage( wxInputStream& stream )
-{
-    if( !stream.IsOk() )
-    {
-        return vector< AnimationFrame >();
-    }
-
-    // special-case animations
-    if( wxGIFDecoder().CanRead( stream ) )
-    {
-        wxGIFDecoder decoder;
-        return LoadAnimation( decoder, stream );
-    }
-    if( wxANIDecoder().CanRead( stream ) )
-    {
-        wxANIDecoder decoder;
-        return LoadAnimation( decoder, stream );
-    }
-
-    // generic multi-image loading
-    vector< AnimationFrame > frames( wxImage::GetImageCount( stream ) );
-    for( int i = 0; i < static_cast< int >( frames.size() ); ++i )
-    {
-        wxSharedPtr< wxImage > image( new wxImage );
-        bool success = false;
-        {
-            // bug workaround
-            // http://trac.wxwidgets.org/ticket/15331
-            wxLogNull logNo;
-            success = image->LoadFile( stream, wxBITMAP_TYPE_ANY, i );
-        }
-
-        frames[ i ].mImage = image;
-        frames[ i ].mDelay = -1;
-    }
-    return frames;
-}
-
 
 // slurp filenames from a directory traversal into a list of wxFileNames
 class FileNameTraverser : public wxDirTraverser
@@ -139,9 +44,11 @@ private:
 class MyFrame : public wxFrame
 {
 public:
-    MyFrame( const wxString& title, const wxString& initialPath )
+    MyFrame( const wxString& title, const wxString& initialPath, const ScaledImageFactory::WorkerOptions& workerOptions )
         : wxFrame( NULL, wxID_ANY, title )
-        , mImagePanel( new wxImagePanel( this ) )
+        , mImagePanel( new wxImagePanel( this, workerOptions ) )
+        , mPrefetcher( PREFETCH_BUDGET )
+        , mForward( true )
     {
         // query all active handlers for their supported extension(s)
         std::set< wxString > exts;
@@ -225,14 +132,54 @@ public:
         {
             SetTitle( mCurFile->GetFullName() + " - QndView" );
 
-            wxFileStream fs( mCurFile->GetFullPath() );
-            vector< AnimationFrame > frames( LoadImage( fs ) );
+            const wxString path( mCurFile->GetFullPath() );
+            vector< AnimationFrame > frames;
+            if( !mPrefetcher.Get( path, frames ) )
+            {
+                wxFileStream fs( path );
+                frames = LoadImage( fs );
+            }
             mImagePanel->SetImages( frames );
         }
+
+        PrefetchNeighbors();
+    }
+
+    // have the files we're likely to go to next decoded in the background,
+    // mostly further along in the direction we've been going
+    void PrefetchNeighbors()
+    {
+        if( mFiles.end() == mCurFile )
+            return;
+
+        const int forward = ( mForward ? 1 : -1 );
+        vector< int > offsets;
+        offsets.push_back( forward );
+        offsets.push_back( -forward );
+        for( int i = 2; i <= PREFETCH_AHEAD; ++i )
+        {
+            offsets.push_back( forward * i );
+        }
+        for( int i = 2; i <= PREFETCH_BEHIND; ++i )
+        {
+            offsets.push_back( -forward * i );
+        }
+
+        vector< wxString > wanted;
+        for( const int offset : offsets )
+        {
+            const FileList::iterator it = GetNeighbor( offset );
+            const wxString path( it->GetFullPath() );
+            if( mCurFile == it || wanted.end() != find( wanted.begin(), wanted.end(), path ) )
+                continue;
+            wanted.push_back( path );
+        }
+        mPrefetcher.SetWanted( wanted );
     }
 
     void AdvanceFile( bool forward = true )
     {
+        mForward = forward;
         if( forward )
         {
             mCurFile++;
@@ -302,6 +249,34 @@ private:
     typedef std::list< wxFileName > FileList;
     FileList mFiles;
     FileList::iterator mCurFile;
+
+    // the file offset places away from the current one, wrapping around
+    FileList::iterator GetNeighbor( int offset )
+    {
+        FileList::iterator it = mCurFile;
+        for( ; offset > 0; --offset )
+        {
+            ++it;
+            if( mFiles.end() == it )
+                it = mFiles.begin();
+        }
+        for( ; offset < 0; ++offset )
+        {
+            if( mFiles.begin() == it )
+                it = mFiles.end();
+            --it;
+        }
+        return it;
+    }
+
+    // decoded neighbors of the current file
+    static const size_t PREFETCH_BUDGET = 512 * 1024 * 1024;   // bytes
+    static const int PREFETCH_AHEAD = 3;
+    static const int PREFETCH_BEHIND = 1;
+    FilePrefetcher mPrefetcher;
+
+    // direction we last moved through mFiles in
+    bool mForward;
 };
 
 
@@ -320,6 +295,24 @@ public:
             wxCMD_LINE_VAL_STRING,
             wxCMD_LINE_PARAM_OPTIONAL
             );
+        parser.AddOption
+            (
+            "t", "threads",
+            "Number of worker threads (default: one less than the number of CPUs)",
+            wxCMD_LINE_VAL_NUMBER
+            );
+        parser.AddOption
+            (
+            "p", "priority",
+            "Worker thread priority from 0 to 100 (default: 50)",
+            wxCMD_LINE_VAL_NUMBER
+            );
+        parser.AddOption
+            (
+            "a", "affinity",
+            "Hex mask of the CPUs worker threads may run on (default: all)",
+            wxCMD_LINE_VAL_STRING
+            );
     }
 
     virtual bool OnCmdLineParsed( wxCmdLineParser& parser )
@@ -330,6 +323,42 @@ public:
             mInitialPath = parser.GetParam( 0 );
         }
 
+        long threads = 0;
+        if( parser.Found( "threads", &threads ) )
+        {
+            if( threads < 1 )
+            {
+                wxLogError( "Need at least one worker thread" );
+                return false;
+            }
+            mWorkerOptions.mCount = static_cast< size_t >( threads );
+        }
+
+        long priority = 0;
+        if( parser.Found( "priority", &priority ) )
+        {
+            if( priority < 0 || priority > 100 )
+            {
+                wxLogError( "Priority must be between 0 and 100" );
+                return false;
+            }
+            mWorkerOptions.mPriority = static_cast< unsigned int >( priority );
+        }
+
+        wxString affinity;
+        if( parser.Found( "affinity", &affinity ) )
+        {
+            if( affinity.StartsWith( "0x" ) || affinity.StartsWith( "0X" ) )
+                affinity = affinity.Mid( 2 );
+            unsigned long long mask = 0;
+            if( !affinity.ToULongLong( &mask, 16 ) || 0 == mask )
+            {
+                wxLogError( "Affinity must be a non-zero hex mask" );
+                return false;
+            }
+            mWorkerOptions.mAffinity = mask;
+        }
+
         return wxApp::OnCmdLineParsed( parser );
     }
 
@@ -348,7 +377,7 @@ public:
         wxInitAllImageHandlers();
 
         // create the main application window
-        MyFrame *frame = new MyFrame( "QndView", mInitialPath );
+        MyFrame *frame = new MyFrame( "QndView", mInitialPath, mWorkerOptions );
 
         // and show it (the frames, unlike simple controls, are not shown when
         // created initially)
@@ -361,6 +390,7 @@ public:
     }
 
     wxString mInitialPath;
+    ScaledImageFactory::WorkerOptions mWorkerOptions;
 };
 
 // Create a new application object: this macro will allow wxWidgets to create
@@ -64,6 +64,70 @@ public:
         return m_threads.back()->Create(stackSize);
     }
 
+    // creates and runs count threads; any that fail to start are left as
+    // NULL in GetThreads()
+    void StartThreads( size_t count, unsigned int priority = WXTHREAD_DEFAULT_PRIORITY )
+    {
+        for( size_t i = 0; i < count; ++i )
+        {
+            CreateThread();
+        }
+
+        for( size_t i = 0; i < m_threads.size(); ++i )
+        {
+            wxThread*& thread = m_threads[i];
+            if( NULL == thread )
+                continue;
+
+            thread->SetPriority( priority );
+            if( thread->Run() != wxTHREAD_NO_ERROR )
+            {
+                delete thread;
+                thread = NULL;
+            }
+        }
+    }
+
+    // waits for every thread to exit and deletes them all, so whatever
+    // tells them to quit has to happen first
+    void JoinThreads()
+    {
+        for( size_t i = 0; i < m_threads.size(); ++i )
+        {
+            if( NULL == m_threads[i] )
+                continue;
+
+            m_threads[i]->Wait();
+            delete m_threads[i];
+        }
+        m_threads.clear();
+    }
+
+    // for threads that sleep on changed until quit: raises quit, wakes
+    // them all and waits for them to exit
+    void StopThreads( wxMutex& mutex, wxCondition& changed, bool& quit )
+    {
+        {
+            wxMutexLocker locker( mutex );
+            quit = true;
+            changed.Broadcast();
+        }
+
+        JoinThreads();
+    }
+
+    // threads that actually started
+    size_t GetThreadCount() const
+    {
+        size_t count = 0;
+        for( size_t i = 0; i < m_threads.size(); ++i )
+        {
+            if( NULL != m_threads[i] )
+                count++;
+        }
+        return count;
+    }
+
     // entry point for the thread - called by Run() and executes in the context
     // of this thread.
     virtual void* Entry() = 0;